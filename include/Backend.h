@@ -3,10 +3,19 @@
 #include "ODrive.h"
 #include "libusbcpp.h"
 #include "Entry.h"
+#include "EntryStore.h"
+#include "SampleScheduler.h"
+#include "DescriptorCache.h"
+#include "DeviceRegistry.h"
+#include "MpscQueue.h"
+#include "CommandQueue.h"
+#include "UsbHotplug.h"
+#include "SoftwareODrive.h"
+#include "SerialTransport.h"
+#include "UsbTransport.h"
 
 #define USB_SCAN_INTERVAL 1.0f
-
-#define MAX_NUMBER_OF_ODRIVES 4
+#define ENDPOINT_CACHE_MAX_TIMEOUTS 3       // Reads that failed all retries until the endpoint cache gives up on a device
 
 #define REF std::reference_wrapper
 extern const char* DEFAULT_ENTRIES_JSON;
@@ -18,12 +27,13 @@ class Backend {
 public:
 
     libusbcpp::context context;
-    std::array<std::shared_ptr<ODrive>, MAX_NUMBER_OF_ODRIVES> odrives;
-    std::shared_ptr<ODrive> temporaryDevice;
-    std::mutex temporaryDeviceMutex;
-    std::atomic<bool> deviceWaiting = false;
+    DescriptorCache descriptorCache;
+    CommandQueue commands;      // Everything the UI needs from a device, must outlive the devices
+    DeviceRegistry odrives;     // Any number of devices, odrvN is the ID in the registry
+    MpscQueue<std::shared_ptr<ODrive>> readyDevices;     // Probed and waiting for handleNewDevices()
 
-    std::vector<Entry> entries;   // Every entry is one line in the control panel
+    EntryStore entries;   // Every entry is one line in the control panel
+    SampleScheduler scheduler;    // Which entries are read in a cycle, each at its own rate
     std::map<std::string, EndpointValue> cachedEndpointValues;   // For endpoint selector, always only one odrive
 
     Backend();
@@ -31,43 +41,80 @@ public:
 
     void listenerThread();
     void handleNewDevices();
+    void handleCompletions();                   // Once per frame on the UI thread, see CommandQueue
     void connectDevice(std::shared_ptr<ODrive> odrv);
+    void connectSerialDevice(const std::string& port, uint32_t baudrate = SERIAL_DEFAULT_BAUDRATE);    // For boards with only UART wired
+    void connectSimulatedDevice(uint64_t serialNumber, double latency = 0.0);    // Software device over a loopback transport
+    void probeDevice(const std::string& description, std::function<std::shared_ptr<ODrive>()> open);    // On its own thread
 
     void addEntry(const Entry& entry);
+    void bindEntry(Entry& entry);               // Resolves the handles of its endpoints on the device it belongs to
     void removeEntry(const std::string& fullPath);
-    void updateEntryCache();
+    double updateEntryCache();                  // Reads the entries that are due, returns the seconds until the next one is
+    void requestEntryUpdate();                  // Makes the next waitForEntryUpdate() return early and reads all entries
+    void wakeEntryUpdate();                     // Only makes the next waitForEntryUpdate() return early
+    void waitForEntryUpdate(double timeout);
     void importEntries(std::string path = "");
     void exportEntries(const std::string& file = "");
     void loadDefaultEntries();
 
     void executeFunction(int odriveID, const std::string& identifier);
     void odriveDisconnected(int odriveID);
+    void updateErrors();                        // Of all odrives, in the background
+    void exportEndpoints(int odriveID);         // Asks where to save once the header was generated
 
-    void updateEndpointCache(int odriveID);
+    void updateEndpointCache(int odriveID);     // In the background, the values show up as they arrive
     EndpointValue getCachedEndpointValue(const std::string& fullPath);
 
+    // Runs 'job' on the I/O worker of the odrive and 'done' with its result on the UI thread in a later frame.
+    // Returns false if there is no such odrive or the same command is still running on it.
+    template<typename F, typename D>
+    bool post(int odriveID, const std::string& key, F job, D done) {
+        auto odrive = odrives.get(odriveID);
+        if (!odrive)
+            return false;
+
+        return commands.post(key + "@odrv" + std::to_string(odriveID), *odrive, std::move(job), std::move(done));
+    }
+
+    // Non-blocking version of readEndpointDirect(), 'done' gets the value on the UI thread
+    bool readEndpointAsync(const BasicEndpoint& ep, const std::string& key, std::function<void(EndpointValue)> done);
 
     EndpointValue readEndpointDirect(const BasicEndpoint& ep);
-    void writeEndpointDirect(const BasicEndpoint& ep, const EndpointValue& value);
 
-    template<typename T>
-    bool readEndpointDirectRaw(const BasicEndpoint& ep, T* value_ptr) {
-        if (!odrives[ep.odriveID])
-            return false;
+    std::vector<EndpointValue> readEndpointsDirect(const std::vector<const BasicEndpoint*>& eps);     // One batch per odrive
 
-        return odrives[ep.odriveID]->read<T>(ep.identifier, value_ptr);
-    }
+    // Non-blocking, the writer thread sends it within one tick. Repeated writes to an endpoint only send the latest value.
+    void queueWrite(const BasicEndpoint& ep, const EndpointValue& value);
+    void queueWrite(const BasicEndpoint& ep, const EndpointValue& value, WriteMode mode);
 
     template<typename T>
-    void writeEndpointDirectRaw(const BasicEndpoint& ep, T value) {
-        if (!odrives[ep.odriveID])
-            return;
+    bool readEndpointDirectRaw(const BasicEndpoint& ep, T* value_ptr) {
+        auto odrive = odrives.get(ep.odriveID);
+        if (!odrive)
+            return false;
 
-        odrives[ep.odriveID]->write<T>(ep.identifier, value);
-        LOG_DEBUG("Writing {} to endpoint {}", value, ep.fullPath);
+        return odrive->read<T>(ep.handle.get(), value_ptr);
     }
 
 private:
+    void writerThread();
+
     std::thread usbListener;
     std::atomic<bool> stopListener = false;
+    std::unique_ptr<UsbHotplug> hotplug;
+
+    std::vector<std::thread> probes;    // Running and finished ones, joined in the destructor
+    std::mutex probeMutex;
+
+    std::thread writer;
+    std::atomic<bool> stopWriter = false;
+    std::mutex writerMutex;
+    std::condition_variable writerCondition;
+    std::unordered_set<std::string> writtenEndpoints;     // Full paths queued since the writer last flushed, guarded by writerMutex
+
+    bool entryUpdateRequested = false;
+    std::atomic<bool> refreshAllEntries = false;
+    std::mutex entryUpdateMutex;
+    std::condition_variable entryUpdateCondition;
 };
@@ -8,3 +8,6 @@ uint8_t CRC8(uint8_t* data, size_t len);
 uint16_t CRC16(uint8_t* data, size_t len);
 
 uint16_t CRC16_JSON(uint8_t* data, size_t len);
+
+// Continue a JSON CRC over the next chunk, starting from the result of the previous one
+uint16_t CRC16_JSON_Update(uint16_t crc, const uint8_t* data, size_t len);
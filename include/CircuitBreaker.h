@@ -0,0 +1,70 @@
+#pragma once
+
+#include "pch.h"
+
+#define ODRIVE_BREAKER_THRESHOLD 3			// Consecutive failed requests until the device counts as not responding
+#define ODRIVE_BREAKER_MIN_BACKOFF 0.25		// Seconds until the first probe, doubled after every failed one
+#define ODRIVE_BREAKER_MAX_BACKOFF 8.0
+
+// Stops talking to a device that keeps timing out, so callers fail right away instead of waiting out every request.
+// While open, the owner sends a probe whenever shouldProbe() says so, and the breaker closes once one succeeds.
+class CircuitBreaker {
+public:
+
+	bool isOpen() const {
+		return open;
+	}
+
+	// Returns true if this opened the breaker
+	bool recordFailure() {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (open || ++failures < ODRIVE_BREAKER_THRESHOLD)
+			return false;
+
+		open = true;
+		backoff = ODRIVE_BREAKER_MIN_BACKOFF;
+		nextProbe = Runtime::getTime() + backoff;
+		return true;
+	}
+
+	void recordSuccess() {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!open) {
+			failures = 0;
+		}
+	}
+
+	// True once per backoff period while open and no probe is running
+	bool shouldProbe() {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!open || probing || Runtime::getTime() < nextProbe)
+			return false;
+
+		probing = true;
+		return true;
+	}
+
+	// Returns true if this closed the breaker
+	bool recordProbe(bool success) {
+		std::lock_guard<std::mutex> lock(mutex);
+		probing = false;
+		if (success) {
+			bool wasOpen = open;
+			open = false;
+			failures = 0;
+			return wasOpen;
+		}
+
+		backoff = std::min(backoff * 2, ODRIVE_BREAKER_MAX_BACKOFF);
+		nextProbe = Runtime::getTime() + backoff;
+		return false;
+	}
+
+private:
+	std::atomic<bool> open = false;
+	int failures = 0;
+	bool probing = false;
+	double backoff = ODRIVE_BREAKER_MIN_BACKOFF;
+	double nextProbe = 0.0;
+	std::mutex mutex;
+};
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "pch.h"
+#include "MpscQueue.h"
+
+#include <set>
+
+// How the UI talks to the devices without waiting for them: A command runs on the I/O worker of its device and
+// its completion is handed back to the UI thread, which picks it up with poll() in one of the next frames.
+// A frame never blocks on USB, no matter how slow the device is or whether it is there at all.
+// post() and poll() are only ever called from the UI thread.
+class CommandQueue {
+public:
+
+	// 'job' gets the device and runs on its worker, 'done' gets the result on the UI thread. While a command with
+	// the same key is running, the new one is dropped and false is returned, so a slow device never piles up commands.
+	template<typename Device, typename F, typename D>
+	bool post(const std::string& key, Device& device, F job, D done) {
+		if (!running.insert(key).second)
+			return false;
+
+		Device* target = &device;		// Not owning, the worker of a device is stopped before the device is gone
+		device.submit([this, key, target, job = std::move(job), done = std::move(done)]() mutable {
+			auto result = job(*target);
+			completions.push([key, done = std::move(done), result = std::move(result)]() mutable {
+				done(std::move(result));
+				return key;
+			});
+		});
+		return true;
+	}
+
+	// Runs the completions of all commands that finished since the last call, returns how many
+	size_t poll() {
+		size_t count = 0;
+		std::function<std::string()> completion;
+		while (completions.pop(completion)) {
+			running.erase(completion());
+			count++;
+		}
+		return count;
+	}
+
+private:
+	MpscQueue<std::function<std::string()>> completions;	// Pushed by the workers, each returns the key of its command
+	std::set<std::string> running;
+};
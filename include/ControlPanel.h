@@ -37,6 +37,14 @@ public:
 		ImGui::PushFont(fonts->robotoMedium);
 
 		ImGui::Text("List of Endpoints");
+		if (ImGui::IsItemHovered()) {
+			SchedulerStats stats = backend->scheduler.getStats();
+			ImGui::BeginTooltip();
+			ImGui::Text("%llu cycles, %llu endpoint reads", (unsigned long long)stats.cycles, (unsigned long long)stats.reads);
+			ImGui::Text("%llu entries deferred by the transaction budget", (unsigned long long)stats.deferred);
+			ImGui::Text("%llu deadlines missed", (unsigned long long)stats.missedDeadlines);
+			ImGui::EndTooltip();
+		}
 		ImGui::SameLine();
 		ImGui::SetCursorPosX(ImGui::GetWindowContentRegionWidth() - 220);
 		if (ImGui::Button("Import")) {
@@ -53,10 +61,10 @@ public:
 		ImGui::Separator();
 
 		std::string toRemove;
-		for (Entry& e : backend->entries) {
-			e.draw();
-			if (e.toBeRemoved) {
-				toRemove = e.endpoint->fullPath;
+		for (auto& e : *backend->entries.getAll()) {
+			e->draw();
+			if (e->toBeRemoved) {
+				toRemove = e->endpoint->fullPath;
 			}
 		}
 
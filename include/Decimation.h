@@ -0,0 +1,30 @@
+#pragma once
+
+#include "pch.h"
+
+// Kernels that reduce a long time series to what can actually be seen on the screen, so the cost of drawing a
+// plot depends on its width and not on the number of samples. Both expect the samples sorted by x and do not
+// allocate. The inner loops use SSE2, which every x64 CPU has, with a scalar fallback for other targets.
+
+// The samples that fall into one pixel column of a plot
+struct DecimatedColumn {
+	double min;
+	double max;
+	double first;	// Values of the first and the last sample, to connect the column to its neighbours
+	double last;
+	size_t count;	// 0 if no sample falls into this column, all values are undefined then
+};
+
+// Splits [xMin, xMax) into 'columns' columns of equal width and finds the extent of the samples in each of them.
+// Finding the columns takes a binary search each, so only the samples in view are ever touched.
+// Returns the number of samples in view.
+size_t decimateMinMax(const double* x, const double* y, size_t count, double xMin, double xMax,
+					  DecimatedColumn* out, size_t columns);
+
+// Largest-Triangle-Three-Buckets: Picks 'threshold' samples that keep the shape of the line, including the first
+// and the last one. A threshold below 3 counts as 3, so outX and outY must hold at least that many. If there are
+// no more than 'threshold' samples, all of them are copied. Returns the number of samples written to outX and outY.
+size_t decimateLTTB(const double* x, const double* y, size_t count, size_t threshold, double* outX, double* outY);
+
+// Smallest and largest value in the array, count must be at least 1
+void findMinMax(const double* values, size_t count, double* min, double* max);
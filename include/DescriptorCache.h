@@ -0,0 +1,33 @@
+#pragma once
+
+#include "pch.h"
+
+#define DESCRIPTOR_CACHE_DIRECTORY "descriptors/"
+#define DESCRIPTOR_CACHE_INDEX "index.json"
+
+struct CachedDescriptorInfo {
+	uint64_t serialNumber = 0;
+	std::string firmwareVersion;
+	uint16_t jsonCRC = 0;
+	uint16_t serialNumberEndpoint = 0;		// Used to validate the descriptor with a single read
+	std::string file;
+};
+
+// Keeps the JSON definitions of known devices on disk, keyed by serial number and firmware version,
+// so a device that reconnects does not need to download it again.
+class DescriptorCache {
+public:
+	DescriptorCache(const std::string& directory);
+
+	std::vector<CachedDescriptorInfo> getCandidates();		// One entry per distinct JSON CRC, most recent first
+	std::string loadDescriptor(const CachedDescriptorInfo& info);
+	void store(CachedDescriptorInfo info, const std::string& json);
+
+private:
+	void loadIndex();
+	void saveIndex();
+
+	std::string directory;
+	std::vector<CachedDescriptorInfo> index;
+	std::mutex mutex;
+};
@@ -0,0 +1,330 @@
+#pragma once
+
+#include "pch.h"
+#include "EndpointTable.h"
+
+// Incremental parser for the JSON definition of a device. Chunks are fed in as they arrive and every endpoint
+// is appended to the table as soon as it is complete, so neither the JSON text nor a DOM has to be kept around.
+// Only the keys of the endpoint schema are interpreted, everything else is checked for syntax and skipped.
+class DescriptorParser {
+public:
+
+	// The table must be empty, it is finalized by finish()
+	DescriptorParser(EndpointTable& table) : table(table) {
+	}
+
+	// Returns false as soon as the input is not valid, everything after that is ignored
+	bool feed(const char* data, size_t length) {
+		for (size_t i = 0; i < length && !failed; i++) {
+			if (!lex(data[i])) {	// The character ended a number or literal and has to be looked at again
+				lex(data[i]);
+			}
+		}
+		return !failed;
+	}
+
+	// Returns true if a complete definition was parsed
+	bool finish() {
+		if (!failed && lexState != LexState::NONE) {
+			lex(' ');		// A number or literal at the very end
+		}
+		if (!failed && !done) {
+			fail("Unexpected end of the definition");
+		}
+		if (failed)
+			return false;
+
+		table.finalize();
+		return true;
+	}
+
+	const std::string& getError() const {
+		return error;
+	}
+
+private:
+	enum class LexState { NONE, STRING, STRING_ESCAPE, STRING_UNICODE, NUMBER, LITERAL };
+	enum class Value { STRING, NUMBER, LITERAL };
+	enum class FrameType { ENDPOINT_LIST, ENDPOINT, IGNORED_ARRAY, IGNORED_OBJECT };
+	enum class Key { NONE, NAME, TYPE, ID, ACCESS, MEMBERS, INPUTS, OUTPUTS, OTHER };
+	enum class Expect { KEY_OR_END, KEY, COLON, VALUE_OR_END, VALUE, COMMA_OR_END };
+
+	struct Frame {
+		FrameType type;
+		Expect expect;
+		Key key = Key::NONE;				// Of the current value in an object
+		uint8_t flags = 0;					// Of the endpoints in a list
+		uint32_t index = ENDPOINT_NONE;		// Of an endpoint
+		EndpointType endpointType = EndpointType::INVALID;
+
+		bool isObject() const {
+			return type == FrameType::ENDPOINT || type == FrameType::IGNORED_OBJECT;
+		}
+	};
+
+	// Returns false if the character was not consumed
+	bool lex(char c) {
+		switch (lexState) {
+		case LexState::STRING:
+			if (c == '"') {
+				lexState = LexState::NONE;
+				onScalar(Value::STRING);
+			}
+			else if (c == '\\') {
+				lexState = LexState::STRING_ESCAPE;
+			}
+			else {
+				token += c;
+			}
+			return true;
+
+		case LexState::STRING_ESCAPE:
+			lexState = LexState::STRING;
+			switch (c) {
+			case 'b': token += '\b'; break;
+			case 'f': token += '\f'; break;
+			case 'n': token += '\n'; break;
+			case 'r': token += '\r'; break;
+			case 't': token += '\t'; break;
+			case 'u': lexState = LexState::STRING_UNICODE; unicode = 0; unicodeDigits = 0; break;
+			default:  token += c; break;
+			}
+			return true;
+
+		case LexState::STRING_UNICODE:
+			if (!isxdigit((uint8_t)c)) {
+				fail("Invalid unicode escape");
+				return true;
+			}
+			unicode = unicode << 4 | (uint32_t)(isdigit((uint8_t)c) ? c - '0' : (tolower(c) - 'a' + 10));
+			if (++unicodeDigits == 4) {
+				appendUtf8(unicode);
+				lexState = LexState::STRING;
+			}
+			return true;
+
+		case LexState::NUMBER:
+		case LexState::LITERAL:
+			if (isalnum((uint8_t)c) || c == '.' || c == '-' || c == '+') {
+				token += c;
+				return true;
+			}
+			onScalar(lexState == LexState::NUMBER ? Value::NUMBER : Value::LITERAL);
+			lexState = LexState::NONE;
+			return false;
+
+		default:
+			break;
+		}
+
+		switch (c) {
+		case ' ': case '\t': case '\r': case '\n':
+			break;
+		case '{':	onBegin(true); break;
+		case '[':	onBegin(false); break;
+		case '}':	onEnd(true); break;
+		case ']':	onEnd(false); break;
+		case ':':	onColon(); break;
+		case ',':	onComma(); break;
+		case '"':
+			lexState = LexState::STRING;
+			token.clear();
+			break;
+		default:
+			if (c == '-' || isdigit((uint8_t)c)) {
+				lexState = LexState::NUMBER;
+			}
+			else if (isalpha((uint8_t)c)) {
+				lexState = LexState::LITERAL;
+			}
+			else {
+				fail(fmt::format("Unexpected character '{}'", c));
+				break;
+			}
+			token.assign(1, c);
+			break;
+		}
+		return true;
+	}
+
+	// A value may only appear at the top, after a ':' or inside an array
+	bool beginValue() {
+		if (done) {
+			fail("Unexpected data after the end of the definition");
+			return false;
+		}
+		if (stack.empty())
+			return true;
+
+		Frame& frame = stack.back();
+		if (frame.expect != Expect::VALUE && frame.expect != Expect::VALUE_OR_END) {
+			fail("Unexpected value");
+			return false;
+		}
+		frame.expect = Expect::COMMA_OR_END;
+		return true;
+	}
+
+	void onScalar(Value value) {
+		if (!stack.empty() && (stack.back().expect == Expect::KEY || stack.back().expect == Expect::KEY_OR_END)) {
+			if (value != Value::STRING) {
+				fail("Expected a key");
+				return;
+			}
+			stack.back().key = parseKey(token);
+			stack.back().expect = Expect::COLON;
+			return;
+		}
+
+		if (!beginValue())
+			return;
+
+		if (value == Value::LITERAL && token != "true" && token != "false" && token != "null") {
+			fail("Invalid literal '" + token + "'");
+			return;
+		}
+		if (stack.empty()) {
+			fail("The definition must be an array");
+			return;
+		}
+
+		Frame& frame = stack.back();
+		if (frame.type != FrameType::ENDPOINT)
+			return;
+
+		switch (frame.key) {
+		case Key::NAME:
+			table.setName(frame.index, token);
+			break;
+		case Key::TYPE:
+			frame.endpointType = parseEndpointType(token);
+			table.setType(frame.index, frame.endpointType);
+			break;
+		case Key::ID:
+			if (value == Value::NUMBER) {
+				table.setId(frame.index, (uint16_t)strtoul(token.c_str(), nullptr, 10));
+			}
+			break;
+		case Key::ACCESS:
+			table.setReadonly(frame.index, token == "r");
+			break;
+		default:
+			break;
+		}
+	}
+
+	void onBegin(bool isObject) {
+		if (!beginValue())
+			return;
+
+		Frame frame;
+		frame.type = isObject ? FrameType::IGNORED_OBJECT : FrameType::IGNORED_ARRAY;
+		frame.expect = isObject ? Expect::KEY_OR_END : Expect::VALUE_OR_END;
+		if (stack.empty()) {
+			if (isObject) {
+				fail("The definition must be an array");
+				return;
+			}
+			frame.type = FrameType::ENDPOINT_LIST;
+		}
+		else if (stack.back().type == FrameType::ENDPOINT_LIST && isObject) {
+			frame.type = FrameType::ENDPOINT;
+			frame.index = table.beginNode(stack.back().flags);
+		}
+		else if (stack.back().type == FrameType::ENDPOINT && !isObject) {
+			switch (stack.back().key) {
+			case Key::MEMBERS:	frame.type = FrameType::ENDPOINT_LIST; break;
+			case Key::INPUTS:	frame.type = FrameType::ENDPOINT_LIST; frame.flags = ENDPOINT_FLAG_INPUT; break;
+			case Key::OUTPUTS:	frame.type = FrameType::ENDPOINT_LIST; frame.flags = ENDPOINT_FLAG_OUTPUT; break;
+			default: break;
+			}
+		}
+		stack.push_back(frame);
+	}
+
+	void onEnd(bool isObject) {
+		if (stack.empty() || stack.back().isObject() != isObject) {
+			fail("Unexpected closing bracket");
+			return;
+		}
+
+		Frame& frame = stack.back();
+		Expect empty = isObject ? Expect::KEY_OR_END : Expect::VALUE_OR_END;
+		if (frame.expect != Expect::COMMA_OR_END && frame.expect != empty) {
+			fail("Unexpected closing bracket");
+			return;
+		}
+
+		if (frame.type == FrameType::ENDPOINT) {
+			table.endNode();
+			if (frame.endpointType == EndpointType::JSON) {		// Ignore the json endpoint (endpoint 0), it has no members
+				table.discardLastNode();
+			}
+		}
+
+		stack.pop_back();
+		if (stack.empty()) {
+			done = true;
+		}
+	}
+
+	void onColon() {
+		if (stack.empty() || stack.back().expect != Expect::COLON) {
+			fail("Unexpected ':'");
+			return;
+		}
+		stack.back().expect = Expect::VALUE;
+	}
+
+	void onComma() {
+		if (stack.empty() || stack.back().expect != Expect::COMMA_OR_END) {
+			fail("Unexpected ','");
+			return;
+		}
+		stack.back().expect = stack.back().isObject() ? Expect::KEY : Expect::VALUE;
+	}
+
+	static Key parseKey(const std::string& key) {
+		if (key == "name")		return Key::NAME;
+		if (key == "type")		return Key::TYPE;
+		if (key == "id")		return Key::ID;
+		if (key == "access")	return Key::ACCESS;
+		if (key == "members")	return Key::MEMBERS;
+		if (key == "inputs")	return Key::INPUTS;
+		if (key == "outputs")	return Key::OUTPUTS;
+		return Key::OTHER;
+	}
+
+	void appendUtf8(uint32_t codepoint) {
+		if (codepoint < 0x80) {
+			token += (char)codepoint;
+		}
+		else if (codepoint < 0x800) {
+			token += (char)(0xC0 | codepoint >> 6);
+			token += (char)(0x80 | (codepoint & 0x3F));
+		}
+		else {
+			token += (char)(0xE0 | codepoint >> 12);
+			token += (char)(0x80 | (codepoint >> 6 & 0x3F));
+			token += (char)(0x80 | (codepoint & 0x3F));
+		}
+	}
+
+	void fail(const std::string& message) {
+		if (!failed) {
+			failed = true;
+			error = message;
+		}
+	}
+
+	EndpointTable& table;
+	std::vector<Frame> stack;
+	bool done = false;
+	bool failed = false;
+	std::string error;
+
+	LexState lexState = LexState::NONE;
+	std::string token;
+	uint32_t unicode = 0;
+	int unicodeDigits = 0;
+};
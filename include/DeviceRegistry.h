@@ -0,0 +1,60 @@
+#pragma once
+
+#include "pch.h"
+#include "ODrive.h"
+
+#include <unordered_map>
+
+// All devices, indexed by their ID. A device keeps its ID for the lifetime of the application, bound to its serial
+// number, so odrvN stays the same board even after it was unplugged and connected again. Readers get an immutable
+// snapshot through std::atomic_load. That is not lock-free: the standard library guards the shared_ptr with a
+// small pool of spinlocks, but only for the copy of the pointer, so readers never wait while a writer builds the
+// next snapshot and hold nothing while they iterate it. Connecting a device builds a new snapshot and publishes it
+// atomically, which is cheap enough because that only happens when the hardware changes.
+class DeviceRegistry {
+public:
+	using Snapshot = std::vector<std::shared_ptr<ODrive>>;
+
+	DeviceRegistry() : snapshot(std::make_shared<const Snapshot>()) {
+	}
+
+	// Stays valid and unchanged while it is held, devices connected meanwhile only show up in the next one.
+	// Costs one pointer copy under the library's shared_ptr lock, see RegistryBenchmark.
+	std::shared_ptr<const Snapshot> getAll() const {
+		return std::atomic_load(&snapshot);
+	}
+
+	// nullptr if there is no device with this ID
+	std::shared_ptr<ODrive> get(int id) const {
+		auto devices = getAll();
+		return (id >= 0 && id < (int)devices->size()) ? (*devices)[id] : nullptr;
+	}
+
+	size_t size() const {
+		return getAll()->size();
+	}
+
+	// Returns the ID of the device: The one it had before if its serial number is known, a new one otherwise.
+	// A device with a known serial number replaces the old instance.
+	int add(std::shared_ptr<ODrive> odrive) {
+		std::lock_guard<std::mutex> lock(mutex);	// Only between writers
+
+		auto devices = std::make_shared<Snapshot>(*snapshot);
+		auto [it, inserted] = ids.emplace(odrive->serialNumber, (int)devices->size());
+		odrive->setODriveID(it->second);		// Before anyone can see it
+		if (inserted) {
+			devices->push_back(odrive);
+		}
+		else {
+			(*devices)[it->second] = odrive;
+		}
+
+		std::atomic_store(&snapshot, std::shared_ptr<const Snapshot>(std::move(devices)));		// Readers see the old or the new one
+		return it->second;
+	}
+
+private:
+	std::shared_ptr<const Snapshot> snapshot;
+	std::unordered_map<uint64_t, int> ids;		// Serial number to ID
+	std::mutex mutex;
+};
@@ -1,7 +1,7 @@
 #pragma once
 
 #include "pch.h"
-#include "config.h"
+#include "json.hpp"
 
 #include <string>
 #include <vector>
@@ -33,21 +33,97 @@ enum class EndpointValueType {
 	INT32
 };
 
+// Names as used in the JSON definition, indexed by EndpointType
+static const char* const ENDPOINT_TYPE_NAMES[] = {
+	"", "json", "bool", "float", "uint8", "uint16", "uint32", "uint64", "int32", "function", "object"
+};
+
+// Only done once when the endpoints are generated, everything else switches on the enum
+static inline EndpointType parseEndpointType(const std::string& name) {
+	for (size_t i = 1; i < std::size(ENDPOINT_TYPE_NAMES); i++) {
+		if (name == ENDPOINT_TYPE_NAMES[i]) {
+			return (EndpointType)i;
+		}
+	}
+	return EndpointType::INVALID;
+}
+
+static inline const char* getEndpointTypeName(EndpointType type) {
+	return ENDPOINT_TYPE_NAMES[(size_t)type];
+}
+
+static inline EndpointValueType getValueType(EndpointType type) {
+	switch (type) {
+	case EndpointType::BOOL:	return EndpointValueType::BOOL;
+	case EndpointType::FLOAT:	return EndpointValueType::FLOAT;
+	case EndpointType::UINT8:	return EndpointValueType::UINT8;
+	case EndpointType::UINT16:	return EndpointValueType::UINT16;
+	case EndpointType::UINT32:	return EndpointValueType::UINT32;
+	case EndpointType::UINT64:	return EndpointValueType::UINT64;
+	case EndpointType::INT32:	return EndpointValueType::INT32;
+	default:					return EndpointValueType::INVALID;
+	}
+}
+
+// An endpoint resolved once by ODrive::resolve(), so hot paths never look up strings again.
+// Only valid for the JSON definition it was resolved against.
+struct EndpointHandle {
+	uint16_t id = 0;
+	uint16_t jsonCRC = 0;
+	EndpointValueType type = EndpointValueType::INVALID;
+	bool valid = false;
+
+	explicit operator bool() const {
+		return valid;
+	}
+};
+
+// The handle of an entry endpoint: The UI thread binds it when the entry or its device shows up, while the poller
+// reads it. Packed into one word, so both only ever see a whole handle without any lock.
+class BoundHandle {
+public:
+	BoundHandle() = default;
+	BoundHandle(const BoundHandle& other) : packed(other.packed.load()) {}
+
+	BoundHandle& operator=(const BoundHandle& other) {
+		packed = other.packed.load();
+		return *this;
+	}
+
+	EndpointHandle get() const {
+		uint64_t value = packed.load();
+		EndpointHandle handle;
+		handle.id = (uint16_t)value;
+		handle.jsonCRC = (uint16_t)(value >> 16);
+		handle.type = (EndpointValueType)((value >> 32) & 0xFF);
+		handle.valid = (value >> 40) & 1;
+		return handle;
+	}
+
+	void set(const EndpointHandle& handle) {
+		packed = (uint64_t)handle.id | (uint64_t)handle.jsonCRC << 16 | (uint64_t)handle.type << 32 | (uint64_t)handle.valid << 40;
+	}
+
+private:
+	std::atomic<uint64_t> packed = 0;
+};
+
 struct BasicEndpoint {
 	std::string identifier;
 	std::string name;
-	std::string type;
+	EndpointType type = EndpointType::INVALID;
 	std::string fullPath;
 	int odriveID = 0;
 	uint16_t id = 0;
 	bool readonly = false;	// Only valid for numeric types
+	BoundHandle handle;		// Only for the endpoints of an entry, see Backend::bindEntry()
 };
 
+
 struct Endpoint {
 
 	BasicEndpoint basic;
 
-	std::vector<Endpoint> children;
 	std::vector<Endpoint> inputs;	// Only valid for functions
 	std::vector<Endpoint> outputs;	// Only valid for functions
 
@@ -61,21 +137,8 @@ struct Endpoint {
 		return &basic;
 	}
 
-	ImVec4 getColor() {
-		if (basic.type == "float") {
-			return COLOR_FLOAT;
-		}
-		if (basic.type == "bool") {
-			return COLOR_BOOL;
-		}
-		return COLOR_UINT;
-	}
-
-	ImGuiInputTextFlags getImGuiFlags() {
-		if (basic.type == "float") {
-			return IMGUI_FLAGS_FLOAT;
-		}
-		return IMGUI_FLAGS_INT;
+	const BasicEndpoint* operator->() const {
+		return &basic;
 	}
 
 	bool fromJson(const nlohmann::json& json) {
@@ -84,7 +147,7 @@ struct Endpoint {
 			// BasicEndpoint
 			basic.identifier = json["identifier"];
 			basic.name = json["name"];
-			basic.type = json["type"];
+			basic.type = parseEndpointType(json["type"]);
 			basic.fullPath = json["full_path"];
 			basic.odriveID = json["odrive_id"];
 			basic.id = json["endpoint_id"];
@@ -119,7 +182,7 @@ struct Endpoint {
 		// BasicEndpoint
 		json["identifier"] = basic.identifier;
 		json["name"] = basic.name;
-		json["type"] = basic.type;
+		json["type"] = getEndpointTypeName(basic.type);
 		json["full_path"] = basic.fullPath;
 		json["odrive_id"] = basic.odriveID;
 		json["endpoint_id"] = basic.id;
@@ -155,14 +218,10 @@ public:
 	EndpointValue(enum EndpointValueType type) : _type(type) {
 	}
 
-	EndpointValue(const std::string& type) {
-		if (type == "bool")		_type = EndpointValueType::BOOL;
-		if (type == "float")	_type = EndpointValueType::FLOAT;
-		if (type == "uint8")	_type = EndpointValueType::UINT8;
-		if (type == "uint16")	_type = EndpointValueType::UINT16;
-		if (type == "uint32")	_type = EndpointValueType::UINT32;
-		if (type == "uint64")	_type = EndpointValueType::UINT64;
-		if (type == "int32")	_type = EndpointValueType::INT32;
+	EndpointValue(EndpointType type) : _type(getValueType(type)) {
+	}
+
+	EndpointValue(const std::string& type) : EndpointValue(parseEndpointType(type)) {
 	}
 
 	EndpointValue(bool value)		{ set(value); _type = EndpointValueType::BOOL; }
@@ -185,7 +244,7 @@ public:
 		memcpy(&this->value, &value, sizeof(T));
 	}
 	
-	std::string toString() {
+	std::string toString() const {
 		std::string str;
 		std::stringstream s;
 		switch (type()) {
@@ -215,6 +274,36 @@ public:
 		return false;
 	}
 
+	// Size of the value on the wire, 0 if the type is invalid
+	size_t size() const {
+		switch (type()) {
+		case EndpointValueType::BOOL:	return sizeof(bool);
+		case EndpointValueType::FLOAT:	return sizeof(float);
+		case EndpointValueType::UINT8:	return sizeof(uint8_t);
+		case EndpointValueType::UINT16:	return sizeof(uint16_t);
+		case EndpointValueType::UINT32:	return sizeof(uint32_t);
+		case EndpointValueType::UINT64:	return sizeof(uint64_t);
+		case EndpointValueType::INT32:	return sizeof(int32_t);
+		case EndpointValueType::INVALID:	return 0;
+		}
+		return 0;
+	}
+
+	// Load the value from a raw response, the length must match the size of the type
+	bool fromBuffer(const uint8_t* data, size_t length) {
+		if (size() == 0 || length != size())
+			return false;
+
+		value = 0;
+		memcpy(&this->value, data, length);
+		return true;
+	}
+
+	// Raw little endian bytes of the value, size() of them are valid
+	const uint8_t* data() const {
+		return (const uint8_t*)&this->value;
+	}
+
 	template<typename T>
 	void operator=(T value) {
 		set<T>(value);
@@ -0,0 +1,278 @@
+#pragma once
+
+#include "pch.h"
+#include "Endpoint.h"
+
+#include <string_view>
+#include <unordered_map>
+
+#define ENDPOINT_NONE 0xFFFFFFFF		// Index of no endpoint, e.g. the parent of a top level endpoint
+
+#define ENDPOINT_FLAG_READONLY 0x01
+#define ENDPOINT_FLAG_INPUT 0x02		// Input argument of the parent function
+#define ENDPOINT_FLAG_OUTPUT 0x04		// Output argument of the parent function
+
+// All endpoints of one JSON definition in a flat table, stored as one array per field. Endpoints are in depth-first
+// order: The subtree of an endpoint occupies [index + 1, getEnd(index)), so its children are found by jumping from
+// one subtree to the next. Names are interned in a single string arena, identifiers are derived from the parent chain.
+class EndpointTable {
+public:
+
+	EndpointTable() = default;
+
+	// Append a new endpoint as the last child of the currently open one. It stays open until endNode().
+	// The fields may be set at any time before finalize(), the JSON does not define an order for them.
+	uint32_t beginNode(uint8_t flags = 0) {
+		uint32_t index = (uint32_t)ids.size();
+		ids.push_back(0);
+		types.push_back(EndpointType::INVALID);
+		this->flags.push_back(flags);
+		parents.push_back(openNodes.empty() ? ENDPOINT_NONE : openNodes.back());
+		ends.push_back(index + 1);
+		nameOffsets.push_back(0);
+		nameLengths.push_back(0);
+		openNodes.push_back(index);
+		return index;
+	}
+
+	void endNode() {
+		ends[openNodes.back()] = (uint32_t)ids.size();
+		openNodes.pop_back();
+	}
+
+	// Remove the endpoint that was just ended, only possible if nothing was appended after it
+	void discardLastNode() {
+		ids.pop_back();
+		types.pop_back();
+		flags.pop_back();
+		parents.pop_back();
+		ends.pop_back();
+		nameOffsets.pop_back();
+		nameLengths.pop_back();
+	}
+
+	void setName(uint32_t index, std::string_view name) {
+		auto it = internedNames.find(std::string(name));
+		if (it == internedNames.end()) {
+			it = internedNames.emplace(std::string(name), (uint32_t)arena.size()).first;
+			arena.append(name);
+		}
+		nameOffsets[index] = it->second;
+		nameLengths[index] = (uint16_t)name.length();
+	}
+
+	void setType(uint32_t index, EndpointType type) { types[index] = type; }
+	void setId(uint32_t index, uint16_t id) { ids[index] = id; }
+	void setReadonly(uint32_t index, bool readonly) {
+		flags[index] = readonly ? (flags[index] | ENDPOINT_FLAG_READONLY) : (flags[index] & ~ENDPOINT_FLAG_READONLY);
+	}
+
+	// Build the lookup index and release everything that was only needed while building
+	void finalize() {
+		std::vector<uint64_t> hashes(ids.size());
+		lookup.clear();
+		lookup.reserve(ids.size());
+		for (uint32_t i = 0; i < ids.size(); i++) {		// Parents come first, so their hash is already known
+			uint64_t hash = (parents[i] == ENDPOINT_NONE) ? FNV_OFFSET_BASIS : hashAppend(hashes[parents[i]], ".");
+			hashes[i] = hashAppend(hash, getName(i));
+			lookup.emplace_back(hashes[i], i);
+		}
+		std::sort(lookup.begin(), lookup.end());
+
+		internedNames = {};
+		openNodes = {};
+		arena.shrink_to_fit();
+	}
+
+	size_t size() const { return ids.size(); }
+	uint16_t getId(uint32_t index) const { return ids[index]; }
+	EndpointType getType(uint32_t index) const { return types[index]; }
+	bool isReadonly(uint32_t index) const { return flags[index] & ENDPOINT_FLAG_READONLY; }
+	bool isInput(uint32_t index) const { return flags[index] & ENDPOINT_FLAG_INPUT; }
+	bool isOutput(uint32_t index) const { return flags[index] & ENDPOINT_FLAG_OUTPUT; }
+	uint32_t getParent(uint32_t index) const { return parents[index]; }
+	uint32_t getEnd(uint32_t index) const { return ends[index]; }
+	bool hasChildren(uint32_t index) const { return ends[index] > index + 1; }
+
+	std::string_view getName(uint32_t index) const {
+		return std::string_view(arena.data() + nameOffsets[index], nameLengths[index]);
+	}
+
+	// e.g. "axis0.motor.error", built from the parent chain
+	std::string getIdentifier(uint32_t index) const {
+		if (parents[index] == ENDPOINT_NONE)
+			return std::string(getName(index));
+
+		return getIdentifier(parents[index]) + "." + std::string(getName(index));
+	}
+
+	// Call f(index) for every direct child, or for every top level endpoint if index is ENDPOINT_NONE
+	template<typename F>
+	void forEachChild(uint32_t index, F&& f) const {
+		uint32_t end = (index == ENDPOINT_NONE) ? (uint32_t)ids.size() : ends[index];
+		for (uint32_t child = (index == ENDPOINT_NONE) ? 0 : index + 1; child < end; child = ends[child]) {
+			f(child);
+		}
+	}
+
+	// Returns ENDPOINT_NONE if there is no endpoint with this identifier
+	uint32_t find(std::string_view identifier) const {
+		uint64_t hash = hashAppend(FNV_OFFSET_BASIS, identifier);
+		auto it = std::lower_bound(lookup.begin(), lookup.end(), std::make_pair(hash, (uint32_t)0));
+		for (; it != lookup.end() && it->first == hash; it++) {
+			if (matches(it->second, identifier)) {
+				return it->second;
+			}
+		}
+		return ENDPOINT_NONE;
+	}
+
+	BasicEndpoint makeBasicEndpoint(uint32_t index, int odriveID) const {
+		BasicEndpoint ep;
+		ep.name = getName(index);
+		ep.identifier = getIdentifier(index);
+		ep.fullPath = "odrv" + std::to_string(odriveID) + "." + ep.identifier;
+		ep.type = types[index];
+		ep.odriveID = odriveID;
+		ep.id = ids[index];
+		ep.readonly = isReadonly(index);
+		return ep;
+	}
+
+	// Standalone copy of one endpoint including its function arguments, e.g. for an entry in the control panel
+	Endpoint makeEndpoint(uint32_t index, int odriveID) const {
+		Endpoint ep;
+		ep.basic = makeBasicEndpoint(index, odriveID);
+		forEachChild(index, [&](uint32_t child) {
+			if (isInput(child)) ep.inputs.push_back(makeEndpoint(child, odriveID));
+			if (isOutput(child)) ep.outputs.push_back(makeEndpoint(child, odriveID));
+		});
+		return ep;
+	}
+
+	size_t getMemoryUsage() const {
+		return ids.capacity() * sizeof(uint16_t) + types.capacity() * sizeof(EndpointType) + flags.capacity() +
+			(parents.capacity() + ends.capacity() + nameOffsets.capacity()) * sizeof(uint32_t) +
+			nameLengths.capacity() * sizeof(uint16_t) + arena.capacity() + lookup.capacity() * sizeof(lookup[0]);
+	}
+
+private:
+	static constexpr uint64_t FNV_OFFSET_BASIS = 0xCBF29CE484222325;
+	static constexpr uint64_t FNV_PRIME = 0x100000001B3;
+
+	static uint64_t hashAppend(uint64_t hash, std::string_view data) {
+		for (char c : data) {
+			hash = (hash ^ (uint8_t)c) * FNV_PRIME;
+		}
+		return hash;
+	}
+
+	// Compare the identifier segment by segment from the back, without building the identifier
+	bool matches(uint32_t index, std::string_view identifier) const {
+		size_t end = identifier.length();
+		for (uint32_t i = index; i != ENDPOINT_NONE; i = parents[i]) {
+			std::string_view name = getName(i);
+			if (end < name.length() || identifier.compare(end - name.length(), name.length(), name) != 0)
+				return false;
+
+			end -= name.length();
+			if (parents[i] != ENDPOINT_NONE) {
+				if (end == 0 || identifier[end - 1] != '.')
+					return false;
+				end--;
+			}
+		}
+		return end == 0;
+	}
+
+	// One entry per endpoint
+	std::vector<uint16_t> ids;
+	std::vector<EndpointType> types;
+	std::vector<uint8_t> flags;
+	std::vector<uint32_t> parents;
+	std::vector<uint32_t> ends;			// One past the last endpoint of the subtree
+	std::vector<uint32_t> nameOffsets;	// Into the arena
+	std::vector<uint16_t> nameLengths;
+
+	std::string arena;
+	std::vector<std::pair<uint64_t, uint32_t>> lookup;	// Identifier hash and index, sorted by hash
+
+	// Only while building
+	std::unordered_map<std::string, uint32_t> internedNames;
+	std::vector<uint32_t> openNodes;
+};
+
+// A table never changes once it is built, so all devices with the same JSON CRC share one instance.
+// Only weak references are kept here, a table is freed when the last device using it is gone.
+class EndpointSchemas {
+public:
+
+	static std::shared_ptr<const EndpointTable> find(uint16_t jsonCRC) {
+		std::lock_guard<std::mutex> lock(getMutex());
+		auto it = getSchemas().find(jsonCRC);
+		if (it == getSchemas().end())
+			return nullptr;
+
+		it->second.lastUsed = ++getUseCounter();
+		return it->second.table.lock();
+	}
+
+	// Returns the instance that is already shared if there is one, otherwise the given table is shared from now on
+	static std::shared_ptr<const EndpointTable> share(uint16_t jsonCRC, std::shared_ptr<const EndpointTable> table) {
+		std::lock_guard<std::mutex> lock(getMutex());
+		auto& schema = getSchemas()[jsonCRC];
+		schema.lastUsed = ++getUseCounter();
+		if (auto existing = schema.table.lock()) {
+			return existing;
+		}
+		schema.table = table;
+		return table;
+	}
+
+	// JSON CRC and serial number endpoint of every schema in use, to find out if a new device matches one of them.
+	// The most recently used one first, it is probed on its own. Schemas no device uses anymore are dropped here.
+	static std::vector<std::pair<uint16_t, uint16_t>> getCandidates() {
+		std::lock_guard<std::mutex> lock(getMutex());
+		std::vector<std::pair<uint64_t, std::pair<uint16_t, uint16_t>>> candidates;
+		for (auto it = getSchemas().begin(); it != getSchemas().end();) {
+			auto table = it->second.table.lock();
+			if (!table) {
+				it = getSchemas().erase(it);
+				continue;
+			}
+			uint32_t index = table->find("serial_number");
+			if (index != ENDPOINT_NONE) {
+				candidates.push_back({ it->second.lastUsed, { it->first, table->getId(index) } });
+			}
+			it++;
+		}
+
+		std::sort(candidates.begin(), candidates.end(), [](auto& a, auto& b) { return a.first > b.first; });
+		std::vector<std::pair<uint16_t, uint16_t>> result;
+		for (auto& candidate : candidates) {
+			result.push_back(candidate.second);
+		}
+		return result;
+	}
+
+private:
+	struct Schema {
+		std::weak_ptr<const EndpointTable> table;
+		uint64_t lastUsed = 0;
+	};
+
+	static std::unordered_map<uint16_t, Schema>& getSchemas() {
+		static std::unordered_map<uint16_t, Schema> schemas;
+		return schemas;
+	}
+
+	static uint64_t& getUseCounter() {
+		static uint64_t counter = 0;
+		return counter;
+	}
+
+	static std::mutex& getMutex() {
+		static std::mutex mutex;
+		return mutex;
+	}
+};
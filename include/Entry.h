@@ -3,54 +3,107 @@
 #include "pch.h"
 #include "Endpoint.h"
 #include "config.h"
+#include "TimeSeries.h"
 
+#define ENTRY_DEFAULT_RATE 5.f		// Hz, for new entries and the ones saved without a rate
+#define ENTRY_MIN_RATE 0.1f
+
+// One poll cycle of an entry, never changed once it is published
+struct EntryValues {
+	std::vector<EndpointValue> values;		// In the order of Entry::appendEndpoints()
+	std::vector<bool> changed;				// Compared to the cycle before
+};
+
+// How often an entry is read, see SampleScheduler. The rate is set by the UI and the statistics are shown there,
+// the rest is only touched by the poller.
+struct EntrySampling {
+	std::atomic<float> rate = ENTRY_DEFAULT_RATE;		// Target in Hz
+	std::atomic<float> achievedRate = 0.f;
+	std::atomic<uint64_t> missedDeadlines = 0;
+	std::atomic<bool> refresh = false;		// Read in the next cycle whatever the rate, see SampleScheduler::markDue()
+
+	double nextDue = 0.0;
+	double lastSample = 0.0;
+	double averageInterval = 0.0;
+};
+
+// The text of one input field and the value read in the background to fill it. A function entry has one per input.
+struct InputField {
+	char buffer[IMGUI_BUFFER_SIZE + 1] = {};
+	std::shared_ptr<EndpointValue> loadedValue = std::make_shared<EndpointValue>();
+	std::string loadedFrom;			// The text when the read was requested, the value is dropped if it changed since
+	bool loadRequested = false;
+};
+
+// The endpoint is fixed once the entry exists, so the poller can read it while the UI draws. The values are written
+// by the poller only, as a new EntryValues each cycle, and the UI picks up the latest one with an atomic load. That
+// locks only for the copy of the pointer, never while the poller builds the next values.
+// Everything else belongs to the UI thread.
 class Entry {
 public:
 	Endpoint endpoint;
-	EndpointValue value;
-	std::map<std::string, EndpointValue> ioValues;
-	std::map<std::string, EndpointValue> oldValues;
+	EntrySampling sampling;
 	bool toBeRemoved = false;
 	
-	char imguiBuffer[IMGUI_BUFFER_SIZE + 1];
 	size_t selected = 0;
 
 private:
 	size_t entryID = 0;
 	inline static size_t entryIDCounter = 0;
+	std::map<std::string, InputField> inputFields;		// By the full path of the input endpoint
 
 public:
 	Entry(const Endpoint& bep);
 	Entry(const nlohmann::json& json);
 
-	void updateValue();
 	void draw();
 
+	// Batched updates: The endpoints are appended in a fixed order and the values are consumed in the same order.
+	// Endpoints that could not be read keep their previous value.
+	void appendEndpoints(std::vector<const BasicEndpoint*>& eps);
+	void updateValues(const EndpointValue* values, double time);
+	size_t getEndpointCount() const;
+
+	std::shared_ptr<const EntryValues> getValues() const {
+		return std::atomic_load(&values);
+	}
+
+	// Everything read from an endpoint, by the index in appendEndpoints(). nullptr for endpoints without a value.
+	std::shared_ptr<TimeSeries> getHistory(size_t index) const {
+		return (index < history.size()) ? history[index] : nullptr;
+	}
+
 	nlohmann::json toJson();
 
 	Entry(const Entry& e) {
 		operator=(e);
-		memset(imguiBuffer, 0, sizeof(imguiBuffer));
 	}
 
 	void operator=(const Entry& e) {
 		endpoint = e.endpoint;
-		value = e.value;
-		ioValues = e.ioValues;
-		oldValues = e.oldValues;
+		std::atomic_store(&values, e.getValues());
+		sampling.rate = e.sampling.rate.load();
+		historyCapacity = e.historyCapacity;
+		createHistory();		// Not shared, there is only ever one writer
 		toBeRemoved = e.toBeRemoved;
 		entryID = entryIDCounter;
 		entryIDCounter++;
 		selected = 0;
-		memset(imguiBuffer, 0, sizeof(imguiBuffer));
+		inputFields.clear();
 	}
 
 private:
-	bool drawImGuiNumberInputField(const std::string& imguiIdentifier, ImGuiInputTextFlags flags);
+	bool drawImGuiNumberInputField(const std::string& imguiIdentifier, char* buffer, ImGuiInputTextFlags flags);
 	void drawImGuiDropdownField(const std::string& imguiIdentifier, const std::vector<std::string>& enumNames);
 	void drawImGuiNumberInput(Endpoint& ep, bool isfloat);
 	void drawImGuiBoolInput(Endpoint& ep);
 	void drawEndpointInput(Endpoint& ep);
+	void drawSamplingMenu();
+	std::string getSamplingText();
+	void resetValues();
+	void createHistory();
 
-	std::mutex mutex;
+	std::shared_ptr<const EntryValues> values;
+	std::vector<std::shared_ptr<TimeSeries>> history;		// Created with the entry and never replaced, only appended to
+	size_t historyCapacity = TIME_SERIES_DEFAULT_CAPACITY;	// Samples per endpoint, saved with the entry as "history"
 };
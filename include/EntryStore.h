@@ -0,0 +1,61 @@
+#pragma once
+
+#include "pch.h"
+#include "Entry.h"
+
+// The entries of the control panel, shared between the UI thread and the poller. Like the device registry, the list
+// is an immutable snapshot that is replaced as a whole when entries are added or removed, so the poller can iterate
+// it while the UI changes it. The values of every entry are published per cycle the same way, see Entry::getValues().
+class EntryStore {
+public:
+	using List = std::vector<std::shared_ptr<Entry>>;
+
+	EntryStore() : list(std::make_shared<const List>()) {
+	}
+
+	// Stays valid and unchanged while it is held. The atomic load only locks for the pointer copy, like in the registry.
+	std::shared_ptr<const List> getAll() const {
+		return std::atomic_load(&list);
+	}
+
+	size_t size() const {
+		return getAll()->size();
+	}
+
+	void add(std::shared_ptr<Entry> entry) {
+		std::lock_guard<std::mutex> lock(mutex);	// Only between writers
+		auto entries = std::make_shared<List>(*list);
+		entries->push_back(std::move(entry));
+		publish(std::move(entries));
+	}
+
+	// The first entry with this path
+	void remove(const std::string& fullPath) {
+		std::lock_guard<std::mutex> lock(mutex);
+		auto entries = std::make_shared<List>(*list);
+		auto it = std::find_if(entries->begin(), entries->end(), [&](auto& e) { return e->endpoint->fullPath == fullPath; });
+		if (it != entries->end()) {
+			entries->erase(it);
+			publish(std::move(entries));
+		}
+	}
+
+	// All at once, the poller either sees the old list or the new one
+	void replace(List entries) {
+		std::lock_guard<std::mutex> lock(mutex);
+		publish(std::make_shared<List>(std::move(entries)));
+	}
+
+	void clear() {
+		replace(List());
+	}
+
+private:
+	// The old list lives on until the last reader drops it
+	void publish(std::shared_ptr<List> entries) {
+		std::atomic_store(&list, std::shared_ptr<const List>(std::move(entries)));
+	}
+
+	std::shared_ptr<const List> list;
+	std::mutex mutex;
+};
@@ -4,10 +4,88 @@
 #include "Fonts.h"
 
 #include "config.h"
+#include "Backend.h"
+#include "Decimation.h"
 
+#define GRAPH_SIDEBAR_WIDTH 320
+#define GRAPH_MAX_SAMPLES (1 << 20)			// Per series, the plot keeps its own copy beyond what the entry history holds
+#define GRAPH_DEFAULT_WINDOW 10.0			// Seconds shown while following the live data
+#define GRAPH_MIN_WINDOW 1e-3
+#define GRAPH_MAX_WINDOW 3600.0
+#define GRAPH_ZOOM_STEP 1.2					// Per notch of the mouse wheel
+#define GRAPH_DENSE_SAMPLES_PER_PIXEL 2.0	// From here on, the samples in view are decimated before drawing
+#define GRAPH_TICK_SPACING 80.f				// Pixels between two grid lines, roughly
+#define GRAPH_MARGIN_LEFT 70.f				// For the labels of the value axis
+#define GRAPH_MARGIN_BOTTOM 25.f			// For the labels of the time axis
+#define GRAPH_LINE_THICKNESS 1.5f
+
+// The main endpoint of one entry, as a line in the plot
+struct GraphSeries {
+	std::string fullPath;
+	std::shared_ptr<TimeSeries> source;
+	uint64_t cursor = 0;			// Next sample to fetch from the source
+	ImVec4 color;
+
+	std::vector<double> times;		// Everything fetched so far, from 'start' on
+	std::vector<double> values;
+	size_t start = 0;
+
+	// Appends whatever the poller recorded since the last frame
+	void fetch() {
+		uint64_t from = std::max(cursor, source->getTail());
+		size_t available = (size_t)(source->getHead() - from);
+		size_t size = times.size();
+		times.resize(size + available);
+		values.resize(size + available);
+		size_t copied = source->copy(cursor, times.data() + size, values.data() + size, available);
+		times.resize(size + copied);
+		values.resize(size + copied);
+
+		// Drop the oldest samples, but only move the rest once half of the buffer is unused
+		if (times.size() - start > GRAPH_MAX_SAMPLES) {
+			start = times.size() - GRAPH_MAX_SAMPLES;
+		}
+		if (start > times.size() / 2) {
+			times.erase(times.begin(), times.begin() + start);
+			values.erase(values.begin(), values.begin() + start);
+			start = 0;
+		}
+	}
+
+	// Samples in [xMin, xMax)
+	std::pair<size_t, size_t> getVisibleRange(double xMin, double xMax) const {
+		auto first = std::lower_bound(times.begin() + start, times.end(), xMin);
+		auto last = std::lower_bound(first, times.end(), xMax);
+		return { first - times.begin(), last - times.begin() };
+	}
+};
+
+// Live plot of the selected entries. The samples in view are reduced to a few points per pixel column with the
+// kernels in Decimation.h, so a million samples cost about as much to draw as a thousand.
 class GraphPanel : public Battery::ImGuiPanel<> {
-public:
 
+	std::vector<GraphSeries> series;
+	size_t nextColor = 0;
+
+	bool follow = true;				// The right edge is always now
+	bool autoscale = true;
+	bool useLTTB = false;			// Instead of min/max per pixel column
+	double window = GRAPH_DEFAULT_WINDOW;
+	double viewEnd = 0.0;
+	double yMin = -1.0;
+	double yMax = 1.0;
+
+	size_t samplesInView = 0;
+	size_t pointsDrawn = 0;
+	double decimationTime = 0.0;
+
+	// Reused every frame
+	std::vector<DecimatedColumn> columns;
+	std::vector<double> lttbX;
+	std::vector<double> lttbY;
+	std::vector<ImVec2> points;
+
+public:
 	GraphPanel() : Battery::ImGuiPanel<>("GraphPanel", { 0, 0 }, { 400, 0 }) {
 
 	}
@@ -19,10 +97,297 @@ public:
 
 	void OnRender() override {
 		auto* fonts = GetFontContainer<FontContainer>();
-		ImGui::PushFont(fonts->openSans25);
+		ImGui::PushFont(fonts->robotoMedium);
+
+		updateSeries();
 
-		ImGui::ShowDemoWindow();
+		ImGui::BeginChild("GraphSeries", { GRAPH_SIDEBAR_WIDTH, 0 });
+		drawSeriesSelection();
+		ImGui::EndChild();
+		ImGui::SameLine();
+
+		ImGui::BeginChild("GraphPlot", { 0, 0 }, false, ImGuiWindowFlags_NoScrollbar | ImGuiWindowFlags_NoScrollWithMouse);
+		ImGui::Checkbox("Follow", &follow);
+		ImGui::SameLine();
+		ImGui::Checkbox("Autoscale", &autoscale);
+		ImGui::SameLine();
+		ImGui::Checkbox("LTTB", &useLTTB);
+		if (ImGui::IsItemHovered()) {
+			ImGui::BeginTooltip();
+			ImGui::Text("Largest-Triangle-Three-Buckets instead of min/max per pixel column");
+			ImGui::EndTooltip();
+		}
+		ImGui::SameLine();
+		ImGui::Text("%zu samples in view, %zu points drawn, decimated in %.2f ms",
+			samplesInView, pointsDrawn, decimationTime * 1000.0);
+		drawPlot();
+		ImGui::EndChild();
 
 		ImGui::PopFont();
 	}
+
+private:
+	// Follows the entries: New samples are fetched, removed entries are dropped and a replaced history is picked up
+	void updateSeries() {
+		auto entries = backend->entries.getAll();
+		for (size_t i = 0; i < series.size(); i++) {
+			GraphSeries& s = series[i];
+			auto entry = std::find_if(entries->begin(), entries->end(), [&](auto& e) { return e->endpoint->fullPath == s.fullPath; });
+			auto history = (entry != entries->end()) ? (*entry)->getHistory(0) : nullptr;
+			if (!history) {
+				series.erase(series.begin() + i);
+				i--;
+				continue;
+			}
+			if (history != s.source) {		// The fetched samples stay, the new history continues in time
+				s.source = history;
+				s.cursor = 0;
+			}
+			s.fetch();
+		}
+	}
+
+	void drawSeriesSelection() {
+		static const ImVec4 palette[] = { LIGHT_BLUE, BROWN, LIGHT_GREEN, YELLOW, RED,
+			IMGUI_COLOR(155, 89, 182, 255), IMGUI_COLOR(236, 240, 241, 255), IMGUI_COLOR(26, 188, 156, 255) };
+
+		ImGui::Text("Plotted endpoints");
+		ImGui::Separator();
+		for (auto& e : *backend->entries.getAll()) {
+			if (!e->getHistory(0)) {		// Functions have nothing to plot
+				continue;
+			}
+			const std::string& path = e->endpoint->fullPath;
+			auto it = std::find_if(series.begin(), series.end(), [&](auto& s) { return s.fullPath == path; });
+			bool checked = (it != series.end());
+
+			ImGui::PushID(path.c_str());
+			if (ImGui::Checkbox(path.c_str(), &checked)) {
+				if (checked) {
+					GraphSeries s;
+					s.fullPath = path;
+					s.source = e->getHistory(0);
+					s.color = palette[nextColor++ % (sizeof(palette) / sizeof(palette[0]))];
+					s.fetch();
+					series.push_back(std::move(s));
+				}
+				else {
+					series.erase(it);
+				}
+			}
+			ImGui::PopID();
+		}
+	}
+
+	void drawPlot() {
+		ImGuiIO& io = ImGui::GetIO();
+		ImVec2 origin = ImGui::GetCursorScreenPos();
+		ImVec2 avail = ImGui::GetContentRegionAvail();
+		float width = std::max(avail.x, 2 * GRAPH_MARGIN_LEFT);
+		float height = std::max(avail.y, 4 * GRAPH_MARGIN_BOTTOM);
+		ImGui::InvisibleButton("##Plot", { width, height });
+		bool hovered = ImGui::IsItemHovered();
+
+		float x0 = origin.x + GRAPH_MARGIN_LEFT;
+		float x1 = origin.x + width;
+		float y0 = origin.y;
+		float y1 = origin.y + height - GRAPH_MARGIN_BOTTOM;
+		float plotWidth = x1 - x0;
+		float plotHeight = y1 - y0;
+
+		// Wheel over the plot zooms in time around the mouse, over the value axis it zooms the values
+		double now = Battery::GetRuntime();
+		if (follow) {
+			viewEnd = now;
+		}
+		if (hovered && io.MouseWheel != 0.f) {
+			double factor = std::pow(GRAPH_ZOOM_STEP, -io.MouseWheel);
+			if (io.MousePos.x < x0) {
+				double center = yMin + (y1 - io.MousePos.y) / plotHeight * (yMax - yMin);
+				yMin = center + (yMin - center) * factor;
+				yMax = center + (yMax - center) * factor;
+				autoscale = false;
+			}
+			else {
+				double newWindow = std::clamp(window * factor, GRAPH_MIN_WINDOW, GRAPH_MAX_WINDOW);
+				if (!follow) {
+					double center = viewEnd - window + (io.MousePos.x - x0) / plotWidth * window;
+					viewEnd = center + (viewEnd - center) * newWindow / window;
+				}
+				window = newWindow;
+			}
+		}
+
+		// Dragging pans in time, and in value once the scale is manual
+		if (ImGui::IsItemActive() && ImGui::IsMouseDragging(ImGuiMouseButton_Left)) {
+			if (io.MouseDelta.x != 0.f) {
+				viewEnd -= io.MouseDelta.x / plotWidth * window;
+				follow = false;
+			}
+			if (!autoscale) {
+				double shift = io.MouseDelta.y / plotHeight * (yMax - yMin);
+				yMin += shift;
+				yMax += shift;
+			}
+		}
+		if (hovered && ImGui::IsMouseDoubleClicked(ImGuiMouseButton_Left)) {
+			follow = true;
+			autoscale = true;
+			window = GRAPH_DEFAULT_WINDOW;
+			viewEnd = now;
+		}
+
+		double xMin = viewEnd - window;
+		double xMax = viewEnd;
+		if (autoscale) {
+			updateAutoscale(xMin, xMax);
+		}
+
+		ImDrawList* drawList = ImGui::GetWindowDrawList();
+		drawList->AddRectFilled({ x0, y0 }, { x1, y1 }, ImGui::GetColorU32(ImGuiCol_FrameBg));
+		drawGrid(drawList, x0, x1, y0, y1, xMin, xMax, now);
+
+		drawList->PushClipRect({ x0, y0 }, { x1, y1 }, true);
+		double startTime = Battery::GetRuntime();
+		samplesInView = 0;
+		pointsDrawn = 0;
+		for (auto& s : series) {
+			buildPoints(s, x0, x1, y0, y1, xMin, xMax);
+			drawList->AddPolyline(points.data(), (int)points.size(), ImGui::ColorConvertFloat4ToU32(s.color), false, GRAPH_LINE_THICKNESS);
+			pointsDrawn += points.size();
+		}
+		decimationTime = Battery::GetRuntime() - startTime;
+		drawLegend(drawList, x0, y0);
+		drawList->PopClipRect();
+
+		drawList->AddRect({ x0, y0 }, { x1, y1 }, ImGui::GetColorU32(ImGuiCol_Border));
+	}
+
+	// Fits the value axis to everything in view, with a bit of room at the top and bottom
+	void updateAutoscale(double xMin, double xMax) {
+		double lo = std::numeric_limits<double>::infinity();
+		double hi = -std::numeric_limits<double>::infinity();
+		for (auto& s : series) {
+			auto [first, last] = s.getVisibleRange(xMin, xMax);
+			if (last > first) {
+				double min, max;
+				findMinMax(s.values.data() + first, last - first, &min, &max);
+				lo = std::min(lo, min);
+				hi = std::max(hi, max);
+			}
+		}
+
+		if (lo > hi) {		// Nothing in view, keep the scale
+			return;
+		}
+		if (hi - lo < 1e-9) {
+			lo -= 0.5;
+			hi += 0.5;
+		}
+		double margin = (hi - lo) * 0.05;
+		yMin = lo - margin;
+		yMax = hi + margin;
+	}
+
+	// The samples of a series in view as screen coordinates, one sample on either side included so the line
+	// reaches the edges. Few samples are drawn as they are, many are decimated first.
+	void buildPoints(const GraphSeries& s, float x0, float x1, float y0, float y1, double xMin, double xMax) {
+		points.clear();
+		auto [first, last] = s.getVisibleRange(xMin, xMax);
+		samplesInView += last - first;
+
+		double xScale = (x1 - x0) / (xMax - xMin);
+		double yScale = (y1 - y0) / (yMax - yMin);
+		auto toScreen = [&](double x, double y) {
+			return ImVec2((float)(x0 + (x - xMin) * xScale), (float)(y1 - (y - yMin) * yScale));
+		};
+
+		size_t pixels = (size_t)std::max(x1 - x0, 1.f);
+		bool dense = (last - first) > pixels * GRAPH_DENSE_SAMPLES_PER_PIXEL;
+		if (first > s.start) {
+			points.push_back(toScreen(s.times[first - 1], s.values[first - 1]));
+		}
+
+		if (!dense) {
+			for (size_t i = first; i < last; i++) {
+				points.push_back(toScreen(s.times[i], s.values[i]));
+			}
+		}
+		else if (useLTTB) {
+			size_t threshold = std::max<size_t>(2 * pixels, 3);
+			lttbX.resize(threshold);
+			lttbY.resize(threshold);
+			size_t count = decimateLTTB(s.times.data() + first, s.values.data() + first, last - first, threshold, lttbX.data(), lttbY.data());
+			for (size_t i = 0; i < count; i++) {
+				points.push_back(toScreen(lttbX[i], lttbY[i]));
+			}
+		}
+		else {
+			// Every column is drawn as a vertical line over its extent, joined to its neighbours by the first and
+			// the last sample, so no peak gets lost
+			columns.resize(pixels);
+			decimateMinMax(s.times.data() + s.start, s.values.data() + s.start, s.times.size() - s.start, xMin, xMax, columns.data(), pixels);
+			for (size_t c = 0; c < pixels; c++) {
+				const DecimatedColumn& column = columns[c];
+				if (column.count == 0) {
+					continue;
+				}
+				float x = x0 + c + 0.5f;
+				points.push_back({ x, toScreen(0, column.first).y });
+				points.push_back({ x, toScreen(0, column.min).y });
+				points.push_back({ x, toScreen(0, column.max).y });
+				points.push_back({ x, toScreen(0, column.last).y });
+			}
+		}
+
+		if (last < s.times.size()) {
+			points.push_back(toScreen(s.times[last], s.values[last]));
+		}
+	}
+
+	// A step of 1, 2 or 5 times a power of ten, so that grid lines are about GRAPH_TICK_SPACING apart
+	static double getTickStep(double range, float pixels) {
+		double raw = range / std::max(pixels / GRAPH_TICK_SPACING, 1.f);
+		double magnitude = std::pow(10.0, std::floor(std::log10(raw)));
+		double normalized = raw / magnitude;
+		return magnitude * ((normalized < 1.5) ? 1.0 : (normalized < 3.5) ? 2.0 : (normalized < 7.5) ? 5.0 : 10.0);
+	}
+
+	// Times are labeled in seconds relative to now
+	void drawGrid(ImDrawList* drawList, float x0, float x1, float y0, float y1, double xMin, double xMax, double now) {
+		ImU32 gridColor = ImGui::GetColorU32(ImGuiCol_Border);
+		ImU32 textColor = ImGui::GetColorU32(ImGuiCol_Text);
+		char label[32];
+
+		double xStep = getTickStep(xMax - xMin, x1 - x0);
+		for (double k = std::ceil((xMin - now) / xStep); k * xStep + now <= xMax; k++) {
+			float x = (float)(x0 + (k * xStep + now - xMin) / (xMax - xMin) * (x1 - x0));
+			drawList->AddLine({ x, y0 }, { x, y1 }, gridColor);
+			snprintf(label, sizeof(label), "%g s", k * xStep);
+			drawList->AddText({ x + 3, y1 + 3 }, textColor, label);
+		}
+
+		double yStep = getTickStep(yMax - yMin, y1 - y0);
+		for (double k = std::ceil(yMin / yStep); k * yStep <= yMax; k++) {
+			float y = (float)(y1 - (k * yStep - yMin) / (yMax - yMin) * (y1 - y0));
+			drawList->AddLine({ x0, y }, { x1, y }, gridColor);
+			snprintf(label, sizeof(label), "%g", k * yStep);
+			drawList->AddText({ x0 - GRAPH_MARGIN_LEFT + 5, y - 9 }, textColor, label);
+		}
+	}
+
+	// Name and latest value of every series
+	void drawLegend(ImDrawList* drawList, float x0, float y0) {
+		ImU32 textColor = ImGui::GetColorU32(ImGuiCol_Text);
+		float y = y0 + 8;
+		for (auto& s : series) {
+			drawList->AddRectFilled({ x0 + 8, y + 4 }, { x0 + 20, y + 16 }, ImGui::ColorConvertFloat4ToU32(s.color));
+			std::string text = s.fullPath;
+			if (s.times.size() > s.start) {
+				text += fmt::format(": {:g}", s.values.back());
+			}
+			drawList->AddText({ x0 + 26, y }, textColor, text.c_str());
+			y += 20;
+		}
+	}
 };
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "pch.h"
+
+#include <condition_variable>
+#include <deque>
+#include <future>
+
+// A thread that runs blocking jobs of one device in order. Every device has its own, so a slow or unresponsive
+// device only ever delays its own requests and the others are polled in parallel.
+class IoWorker {
+public:
+
+	IoWorker() {
+		thread = std::thread(&IoWorker::run, this);
+	}
+
+	~IoWorker() {
+		stop();
+	}
+
+	// The result is collected through the returned future. Once the worker is stopped, jobs run right away on the caller.
+	template<typename F>
+	auto submit(F&& job) -> std::future<decltype(job())> {
+		auto task = std::make_shared<std::packaged_task<decltype(job())()>>(std::forward<F>(job));
+		auto future = task->get_future();
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!stopped) {
+				jobs.emplace_back([task] { (*task)(); });
+				task.reset();
+			}
+		}
+
+		if (task) {
+			(*task)();
+		}
+		else {
+			condition.notify_all();
+		}
+		return future;
+	}
+
+	// Runs what is still queued and joins the thread
+	void stop() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopped = true;
+		}
+		condition.notify_all();
+		if (thread.joinable()) {
+			thread.join();
+		}
+	}
+
+private:
+	void run() {
+		while (true) {
+			std::function<void()> job;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				condition.wait(lock, [&] { return stopped || !jobs.empty(); });
+				if (jobs.empty())
+					break;
+
+				job = std::move(jobs.front());
+				jobs.pop_front();
+			}
+			job();
+		}
+	}
+
+	std::deque<std::function<void()>> jobs;
+	bool stopped = false;
+	std::mutex mutex;
+	std::condition_variable condition;
+	std::thread thread;
+};
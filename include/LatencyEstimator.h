@@ -0,0 +1,60 @@
+#pragma once
+
+#include "pch.h"
+
+#define ODRIVE_LATENCY_SAMPLES 128			// Round trip times remembered per device
+#define ODRIVE_LATENCY_MIN_SAMPLES 16		// Below this the caller's fallback deadline is used
+#define ODRIVE_LATENCY_UPDATE_INTERVAL 16	// The percentile is recomputed every this many samples
+#define ODRIVE_LATENCY_PERCENTILE 0.99
+#define ODRIVE_DEADLINE_FACTOR 3.0			// Deadline = p99 round trip time * factor
+#define ODRIVE_MIN_DEADLINE 0.002			// Seconds, keeps scheduling jitter from causing timeouts
+
+// Tracks the round trip times of one device and derives how long it is reasonable to wait for a response.
+// Not thread safe, the owner must lock it.
+class LatencyEstimator {
+public:
+
+	LatencyEstimator() {
+		samples.fill(0.0);
+	}
+
+	void addSample(double seconds) {
+		samples[cursor] = seconds;
+		cursor = (cursor + 1) % ODRIVE_LATENCY_SAMPLES;
+		count = std::min<size_t>(count + 1, ODRIVE_LATENCY_SAMPLES);
+
+		if (++sinceUpdate >= ODRIVE_LATENCY_UPDATE_INTERVAL || count == ODRIVE_LATENCY_MIN_SAMPLES) {
+			update();
+		}
+	}
+
+	// Deadline for the next request, never longer than the fallback
+	double getDeadline(double fallback) const {
+		if (count < ODRIVE_LATENCY_MIN_SAMPLES)
+			return fallback;
+
+		return std::clamp(percentile * ODRIVE_DEADLINE_FACTOR, std::min(ODRIVE_MIN_DEADLINE, fallback), fallback);
+	}
+
+	// Round trip time at ODRIVE_LATENCY_PERCENTILE in seconds, 0 if not known yet
+	double getPercentile() const {
+		return (count < ODRIVE_LATENCY_MIN_SAMPLES) ? 0.0 : percentile;
+	}
+
+private:
+	void update() {
+		std::array<double, ODRIVE_LATENCY_SAMPLES> sorted;
+		std::copy(samples.begin(), samples.begin() + count, sorted.begin());
+
+		size_t index = std::min<size_t>((size_t)(ODRIVE_LATENCY_PERCENTILE * count), count - 1);
+		std::nth_element(sorted.begin(), sorted.begin() + index, sorted.begin() + count);
+		percentile = sorted[index];
+		sinceUpdate = 0;
+	}
+
+	std::array<double, ODRIVE_LATENCY_SAMPLES> samples;
+	size_t cursor = 0;
+	size_t count = 0;
+	size_t sinceUpdate = 0;
+	double percentile = 0.0;
+};
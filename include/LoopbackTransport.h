@@ -0,0 +1,177 @@
+#pragma once
+
+#include "pch.h"
+#include "Transport.h"
+
+#include <chrono>
+#include <condition_variable>
+
+#define LOOPBACK_MAX_FRAME_SIZE 64
+#define LOOPBACK_QUEUE_SIZE 64
+
+// Something that answers native protocol frames in software, e.g. SoftwareODrive
+class DeviceModel {
+public:
+	virtual ~DeviceModel() = default;
+
+	// Handle one request frame. Returns the length of the response written into 'response',
+	// or -1 if the request is not answered.
+	virtual int handleFrame(const uint8_t* frame, size_t length, uint8_t* response, size_t maxResponseLength) = 0;
+};
+
+// Deterministic misbehaviour of the link, to test the protocol stack against what a real one does occasionally
+struct LoopbackFaults {
+	size_t reorderEvery = 0;		// Every n-th response is held back and sent after the next one, 0 for never
+	size_t duplicateEvery = 0;		// Every n-th response is sent twice, 0 for never
+};
+
+// In-process transport that hands every frame to a device model on its own thread. An optional latency is
+// applied to every frame individually, so pipelined requests overlap just like on a real link.
+class LoopbackTransport : public Transport {
+public:
+
+	LoopbackTransport(std::shared_ptr<DeviceModel> model, double latency = 0.0, LoopbackFaults faults = LoopbackFaults())
+		: model(model), latency(latency), faults(faults) {
+		if (!model) {
+			throw std::runtime_error("Loopback device model is nullptr!");
+		}
+	}
+
+	~LoopbackTransport() {
+		close();
+	}
+
+	void start(ReceiveCallback onReceive, ErrorCallback onError) override {
+		this->onReceive = onReceive;
+		this->onError = onError;
+		deviceThread = std::thread(&LoopbackTransport::deviceLoop, this);
+	}
+
+	bool sendFrame(const uint8_t* data, size_t length) override {
+		if (length > LOOPBACK_MAX_FRAME_SIZE)
+			return false;
+
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			condition.wait(lock, [&] { return stopped || queued < LOOPBACK_QUEUE_SIZE; });
+			if (stopped)
+				return false;
+
+			Frame& frame = queue[(head + queued) % LOOPBACK_QUEUE_SIZE];
+			memcpy(frame.data, data, length);
+			frame.length = length;
+			frame.due = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+				std::chrono::duration<double>(latency));
+			queued++;
+			framesSent++;
+			bytesSent += length;
+		}
+		condition.notify_all();
+		return true;
+	}
+
+	void stop() override {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopped = true;
+		}
+		condition.notify_all();
+	}
+
+	void close() override {
+		stop();
+		if (deviceThread.joinable() && deviceThread.get_id() != std::this_thread::get_id()) {
+			deviceThread.join();
+		}
+	}
+
+	TransportStats getStats() override {
+		TransportStats stats;
+		stats.framesSent = framesSent;
+		stats.framesReceived = framesReceived;
+		stats.bytesSent = bytesSent;
+		stats.bytesReceived = bytesReceived;
+		return stats;
+	}
+
+private:
+	struct Frame {
+		uint8_t data[LOOPBACK_MAX_FRAME_SIZE];
+		size_t length = 0;
+		std::chrono::steady_clock::time_point due;
+	};
+
+	void deviceLoop() {
+		uint8_t response[LOOPBACK_MAX_FRAME_SIZE];
+		uint8_t held[LOOPBACK_MAX_FRAME_SIZE];
+		int heldLength = -1;
+		uint64_t responses = 0;
+		while (true) {
+			Frame frame;
+			bool more = false;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				condition.wait(lock, [&] { return stopped || queued > 0; });
+				if (stopped)
+					break;
+
+				// Frames are answered in order, each one once its latency has passed
+				if (condition.wait_until(lock, queue[head].due, [&] { return stopped.load(); }))
+					break;
+
+				frame = queue[head];
+				head = (head + 1) % LOOPBACK_QUEUE_SIZE;
+				queued--;
+				more = (queued > 0);
+			}
+			condition.notify_all();
+
+			int length = model->handleFrame(frame.data, frame.length, response, sizeof(response));
+			if (length >= 0) {
+				responses++;
+				if (faults.reorderEvery > 0 && responses % faults.reorderEvery == 0 && more && heldLength < 0) {
+					memcpy(held, response, length);		// Only if another frame follows, so it is not held forever
+					heldLength = length;
+					continue;
+				}
+
+				deliver(response, length);
+				if (faults.duplicateEvery > 0 && responses % faults.duplicateEvery == 0) {
+					deliver(response, length);
+				}
+			}
+
+			if (heldLength >= 0 && (length >= 0 || !more)) {
+				deliver(held, heldLength);
+				heldLength = -1;
+			}
+		}
+	}
+
+	void deliver(const uint8_t* response, int length) {
+		framesReceived++;
+		bytesReceived += length;
+		onReceive(response, length);
+	}
+
+	std::shared_ptr<DeviceModel> model;
+	double latency;
+	LoopbackFaults faults;
+
+	ReceiveCallback onReceive;
+	ErrorCallback onError;
+
+	std::array<Frame, LOOPBACK_QUEUE_SIZE> queue;
+	size_t head = 0;
+	size_t queued = 0;
+
+	std::atomic<uint64_t> framesSent = 0;
+	std::atomic<uint64_t> framesReceived = 0;
+	std::atomic<uint64_t> bytesSent = 0;
+	std::atomic<uint64_t> bytesReceived = 0;
+
+	std::atomic<bool> stopped = false;
+	std::mutex mutex;
+	std::condition_variable condition;
+	std::thread deviceThread;
+};
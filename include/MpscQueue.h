@@ -0,0 +1,54 @@
+#pragma once
+
+#include "pch.h"
+
+// Unbounded lock-free queue for any number of producers and a single consumer. Pushing is one atomic exchange,
+// so a producer never waits for another one or for the consumer.
+template<typename T>
+class MpscQueue {
+public:
+
+	MpscQueue() {
+		tail = new Node();		// The consumer always keeps one node, whose value was already taken
+		head = tail;
+	}
+
+	~MpscQueue() {
+		while (tail) {
+			Node* next = tail->next.load(std::memory_order_relaxed);
+			delete tail;
+			tail = next;
+		}
+	}
+
+	MpscQueue(const MpscQueue&) = delete;
+	MpscQueue& operator=(const MpscQueue&) = delete;
+
+	void push(T value) {
+		Node* node = new Node();
+		node->value = std::move(value);
+		Node* previous = head.exchange(node, std::memory_order_acq_rel);
+		previous->next.store(node, std::memory_order_release);
+	}
+
+	// Consumer only. Returns false if the queue is empty, or if a push is just between its two steps.
+	bool pop(T& value) {
+		Node* next = tail->next.load(std::memory_order_acquire);
+		if (!next)
+			return false;
+
+		value = std::move(next->value);
+		delete tail;
+		tail = next;
+		return true;
+	}
+
+private:
+	struct Node {
+		std::atomic<Node*> next = nullptr;
+		T value;
+	};
+
+	std::atomic<Node*> head;	// Last pushed node
+	Node* tail;					// Owned by the consumer
+};
@@ -1,23 +1,29 @@
 #pragma once
 
-#include "libusbcpp.h"
 #include "CRC.h"
 #include "Endpoint.h"
-#include "libusbcpp.h"
+#include "EndpointTable.h"
+#include "DescriptorParser.h"
+#include "ResponseDemultiplexer.h"
+#include "DescriptorCache.h"
+#include "WriteQueue.h"
+#include "IoWorker.h"
+#include "CircuitBreaker.h"
+#include "Transport.h"
 #include <stdio.h>
+#include <deque>
 
 #include "json.hpp"
 
-#define ODRIVE_VENDOR_ID 0x1209
-#define ODRIVE_PRODUCT_ID 0x0D32
+#define ODRIVE_MAX_FRAME_SIZE 64
 
-#define ODRIVE_USB_INTERFACE 2
-#define ODRIVE_USB_READ_ENDPOINT (uint16_t)0x83
-#define ODRIVE_USB_WRITE_ENDPOINT (uint16_t)0x03
+#define ODRIVE_TIMEOUT 0.5		// Upper bound for one request including all retries, in seconds
+#define ODRIVE_MAX_RETRIES 3	// Resends after the adaptive deadline passed, the last attempt gets the rest of ODRIVE_TIMEOUT
 
-#define ODRIVE_TIMEOUT 0.5		// Read/Write timeout in seconds
+#define ODRIVE_JSON_CHUNK_SIZE 32
+#define ODRIVE_JSON_WINDOW 16		// Number of JSON chunks requested ahead while downloading
+#define ODRIVE_PROBE_BATCH 8		// Cached descriptors validated at once, well within the in-flight window
 
-typedef std::vector<uint8_t> buffer_t;
 using njson = nlohmann::json;
 
 static inline std::string toUpper(const std::string& str) {
@@ -39,13 +45,12 @@ static inline std::string replace(const std::string& str, char find, char replac
 class ODrive {
 public:
 
-	bool connected = true;
-	bool loaded = false;
+	std::atomic<bool> connected = true;
+	std::atomic<bool> loaded = false;
 	uint16_t jsonCRC = 0x00;
 	uint64_t serialNumber = 0;
-	std::string json;
-	std::vector<Endpoint> endpoints;
-	std::vector<BasicEndpoint> cachedEndpoints;
+	std::shared_ptr<const EndpointTable> endpoints = std::make_shared<EndpointTable>();	// Shared with all devices with the same JSON CRC
+	std::atomic<int> odriveID = 0;		// The only per-device part of an endpoint path, set by the registry while other threads read it
 
 	bool error = false;
 	int32_t axis0Error = 0x00;
@@ -57,58 +62,64 @@ public:
 	int32_t controller0Error = 0x00;
 	int32_t controller1Error = 0x00;
 
-	ODrive(libusbcpp::device device) : device(device) {
-		if (!device) {
-			throw std::runtime_error("ODrive device is nullptr!");
-		}
-		if (!device->claimInterface(ODRIVE_USB_INTERFACE)) {
-			throw std::runtime_error("Cannot claim USB interface");
+	ODrive(std::unique_ptr<Transport> transport, DescriptorCache* descriptorCache = nullptr) 
+		: transport(std::move(transport)), descriptorCache(descriptorCache) {
+		if (!this->transport) {
+			throw std::runtime_error("ODrive transport is nullptr!");
 		}
+		this->transport->start([this](const uint8_t* data, size_t length) { onPacket(data, length); }, [this] { disconnect(); });
 		load(999);
 	}
 
+	~ODrive() {
+		setDisconnectCallback(nullptr);		// Whoever set it may already be gone
+		demux.close();		// Wakes up a job of the worker that is still waiting for a response
+		worker.stop();
+		transport->close();
+	}
+
 	template<typename T>
 	bool read(uint16_t endpoint, T* value_ptr) {
 
-		if (!loaded || !connected)
+		if (!isAvailable())
 			return false;
 
-		std::lock_guard<std::mutex> lock(transferMutex);
-		uint16_t sequence = sendReadRequest(endpoint, sizeof(T), {}, jsonCRC);
-
-		double start = Battery::GetRuntime();
-		while (Battery::GetRuntime() < start + ODRIVE_TIMEOUT) {
-			auto& response = getResponse(sizeof(T));
-			if ((response.first & 0b0111111111111111) == sequence && response.second.size() == sizeof(T)) {
-				memcpy(value_ptr, &response.second[0], sizeof(T));
-				return true;
-			}
+		auto request = requestWithRetries([&] { return submitRead(endpoint, sizeof(T), value_ptr); });	// Decoded straight into *value_ptr
+		if (request && request->responseSize == sizeof(T)) {
+			return true;
 		}
+		if (!isAvailable())		// Cancelled, not worth a warning
+			return false;
+
 		LOG_WARN("Timeout: Failed to read endpoint {}", endpoint);
 		LOG_WARN("Requested data was: Endpoint: {}, type {}, no payload, crc=0x{:04X}", endpoint, typeid(T).name(), jsonCRC);
 		return false;
 	}
 
 	template<typename T>
-	bool read(const std::string& identifier, T* value_ptr) {
-		auto endpoint = findEndpoint(identifier);
-		if (!endpoint)
+	bool read(const EndpointHandle& handle, T* value_ptr) {
+		if (!isCurrent(handle))
 			return false;
 
-		return read<T>(endpoint->id, value_ptr);
+		return read<T>(handle.id, value_ptr);
 	}
 
 	template<typename T>
-	bool write(uint16_t endpoint, T value) {
+	bool read(const std::string& identifier, T* value_ptr) {
+		return read<T>(findEndpoint(identifier), value_ptr);
+	}
 
-		if (!loaded || !connected)
+	// An acknowledged write blocks until the device confirmed it, an unacknowledged one returns as soon as it is queued
+	template<typename T>
+	bool write(uint16_t endpoint, T value, WriteMode mode = WriteMode::ACKNOWLEDGED) {
+
+		if (!isAvailable())
 			return false;
 
-		std::vector<uint8_t> payload(sizeof(T), 0);
-		memcpy(&payload[0], &value, sizeof(T));
+		if (!writeRaw(endpoint, (const uint8_t*)&value, sizeof(T), mode)) {
+			if (!isAvailable())
+				return false;
 
-		std::lock_guard<std::mutex> lock(transferMutex);
-		if (sendWriteRequest(endpoint, sizeof(T), payload, jsonCRC) == -1) {
 			LOG_WARN("Timeout: Failed to write endpoint {} value {}", endpoint, value);
 			LOG_WARN("Written data was: Endpoint: {}, type {}, payload=value, crc=0x{:04X}", endpoint, typeid(T).name(), jsonCRC);
 			return false;
@@ -118,23 +129,165 @@ public:
 	}
 
 	template<typename T>
-	bool write(const std::string& identifier, T value) {
-		auto endpoint = findEndpoint(identifier);
-		if (endpoint) {
-			return write<T>(endpoint->id, value);
+	bool write(const EndpointHandle& handle, T value, WriteMode mode = WriteMode::ACKNOWLEDGED) {
+		if (!isCurrent(handle))
+			return false;
+
+		return write<T>(handle.id, value, mode);
+	}
+
+	template<typename T>
+	bool write(const std::string& identifier, T value, WriteMode mode = WriteMode::ACKNOWLEDGED) {
+		return write<T>(findEndpoint(identifier), value, mode);
+	}
+
+	// Read several endpoints in one batch: All requests are sent back to back and the replies collected together.
+	// The returned values are in the same order, an entry is INVALID if that endpoint could not be read.
+	std::vector<EndpointValue> readMany(const std::vector<std::pair<uint16_t, EndpointValueType>>& endpoints) {
+
+		std::vector<EndpointValue> values(endpoints.size());
+		if (!isAvailable())
+			return values;
+
+		std::vector<std::shared_ptr<PendingRequest>> requests(endpoints.size());
+		for (size_t i = 0; i < endpoints.size(); i++) {
+			size_t size = EndpointValue(endpoints[i].second).size();
+			if (size > 0) {
+				requests[i] = submitRead(endpoints[i].first, (uint16_t)size);
+			}
 		}
-		return false;
+
+		for (size_t i = 0; i < endpoints.size(); i++) {
+			if (requests[i] && !awaitResponse(requests[i])) {		// Only the lost ones are sent again
+				uint16_t size = requests[i]->expectedResponseSize;
+				requests[i] = requestWithRetries([&] { return submitRead(endpoints[i].first, size); });
+			}
+
+			EndpointValue value(endpoints[i].second);
+			if (requests[i] && value.fromBuffer(requests[i]->response, requests[i]->responseSize)) {
+				values[i] = value;
+			}
+			else if (requests[i] && isAvailable()) {
+				LOG_WARN("Timeout: Failed to read endpoint {} in batch", endpoints[i].first);
+			}
+		}
+
+		return values;
+	}
+
+	// Same as above through handles. A handle of another JSON definition is not sent, its value stays INVALID.
+	std::vector<EndpointValue> readMany(const std::vector<EndpointHandle>& handles) {
+		std::vector<std::pair<uint16_t, EndpointValueType>> endpoints;
+		endpoints.reserve(handles.size());
+		for (auto& handle : handles) {
+			endpoints.emplace_back(handle.id, isCurrent(handle) ? handle.type : EndpointValueType::INVALID);
+		}
+		return readMany(endpoints);
+	}
+
+	// Run any job on the I/O worker of this device, after everything submitted before
+	template<typename F>
+	auto submit(F&& job) {
+		return worker.submit(std::forward<F>(job));
+	}
+
+	// Same as readMany(), but on the I/O worker of this device. The caller can start the reads of other devices
+	// before collecting the results, so all devices are polled in parallel.
+	std::future<std::vector<EndpointValue>> readManyAsync(std::vector<std::pair<uint16_t, EndpointValueType>> endpoints) {
+		return worker.submit([this, endpoints = std::move(endpoints)] { return readMany(endpoints); });
+	}
+
+	std::future<std::vector<EndpointValue>> readManyAsync(std::vector<EndpointHandle> handles) {
+		return worker.submit([this, handles = std::move(handles)] { return readMany(handles); });
+	}
+
+	// Write several endpoints back to back. Acknowledged writes are all sent before the first confirmation is awaited.
+	bool writeMany(const std::vector<std::pair<uint16_t, EndpointValue>>& values, WriteMode mode = WriteMode::ACKNOWLEDGED) {
+
+		if (!isAvailable())
+			return false;
+
+		std::vector<std::pair<const std::pair<uint16_t, EndpointValue>*, std::shared_ptr<PendingRequest>>> requests;
+		for (auto& write : values) {
+			auto& [endpoint, value] = write;
+			if (value.size() == 0)
+				continue;
+
+			if (mode == WriteMode::UNACKNOWLEDGED) {
+				if (sendWriteRequest(endpoint, 0, value.data(), value.size(), jsonCRC) == ODRIVE_NO_SEQUENCE) {
+					LOG_WARN("Failed to write endpoint {} in batch", endpoint);
+					return false;
+				}
+			}
+			else {
+				requests.emplace_back(&write, submitRequest(endpoint, 0, value.data(), value.size(), jsonCRC));
+			}
+		}
+
+		bool success = true;
+		for (auto& [write, request] : requests) {
+			if (request && awaitResponse(request))
+				continue;
+
+			uint16_t endpoint = write->first;		// Lost, the write is idempotent so it is simply sent again
+			const EndpointValue& value = write->second;
+			if (!requestWithRetries([&] { return submitRequest(endpoint, 0, value.data(), value.size(), jsonCRC); })) {
+				if (isAvailable()) {
+					LOG_WARN("Timeout: Write to endpoint {} in batch was not acknowledged", endpoint);
+				}
+				success = false;
+			}
+		}
+
+		return success;
+	}
+
+	// Queue a write for the next flushWrites(). A newer value for the same endpoint replaces the pending one.
+	void queueWrite(uint16_t endpoint, const EndpointValue& value, WriteMode mode) {
+		writeQueue.push(endpoint, value, mode);
+	}
+
+	// Returns false if the handle belongs to another JSON definition, nothing is queued then
+	bool queueWrite(const EndpointHandle& handle, const EndpointValue& value, WriteMode mode) {
+		if (!isCurrent(handle))
+			return false;
+
+		queueWrite(handle.id, value, mode);
+		return true;
+	}
+
+	// Send everything that was queued since the last flush, returns the number of writes sent
+	size_t flushWrites() {
+		auto writes = writeQueue.take();
+		if (writes.empty() || !isAvailable())
+			return 0;
+
+		// In the order they were queued, a new batch starts whenever the write mode changes
+		std::vector<std::pair<uint16_t, EndpointValue>> batch;
+		for (size_t i = 0; i < writes.size(); i++) {
+			batch.emplace_back(writes[i].endpoint, writes[i].value);
+			if (i + 1 == writes.size() || writes[i + 1].mode != writes[i].mode) {
+				writeMany(batch, writes[i].mode);
+				batch.clear();
+			}
+		}
+		return writes.size();
+	}
+
+	bool hasPendingWrites() {
+		return !writeQueue.empty();
 	}
 
 	void executeFunction(const std::string& identifier) {
 		auto endpoint = findEndpoint(identifier);
-		if (endpoint) {
-			std::lock_guard<std::mutex> lock(transferMutex);
-			sendWriteRequest(endpoint->id, 1, { 0 }, jsonCRC);
+		if (endpoint && isAvailable()) {
+			uint8_t trigger = 0;
+			sendWriteRequest(endpoint.id, 1, &trigger, sizeof(trigger), jsonCRC);
 		}
 	}
 
-	void exportEndpoints() {
+	// The endpoints as a C header for the ODriveNativeLib, reads the firmware version from the device
+	std::string generateEndpointHeader() {
 		std::string file;
 
 		uint8_t fw_version_major;
@@ -176,240 +329,535 @@ public:
 
 		file += "#define JSON_CRC " + fmt::format("0x{:04X}", jsonCRC) + "\n\n";
 		
-		for (auto& endpoint : cachedEndpoints) {
-			std::string identifier = replace(toUpper(endpoint.identifier), '.', '_');
-			std::string type = endpoint.type;
+		const EndpointTable& table = *endpoints;
+		for (uint32_t i = 0; i < table.size(); i++) {
+			if (table.getType(i) == EndpointType::OBJECT)
+				continue;
+
+			std::string identifier = replace(toUpper(table.getIdentifier(i)), '.', '_');
+			std::string type = getEndpointTypeName(table.getType(i));
 			if (type.find("int") != std::string::npos) type += "_t";
-			if (type == "function") type = "bool";
+			if (table.getType(i) == EndpointType::FUNCTION) type = "bool";
 			file += "#define ENDPOINT_TYPE_" + identifier + " " + type + "\n";
-			file += "#define ENDPOINT_ID_" + identifier + " " + std::to_string(endpoint.id) + "\n";
+			file += "#define ENDPOINT_ID_" + identifier + " " + std::to_string(table.getId(i)) + "\n";
 			file += "#define ENDPOINT_" + identifier + " JSON_CRC, ENDPOINT_ID_" + 
 				identifier + ", ENDPOINT_TYPE_" + identifier + "\n\n";
 		}
 
 		file += "#endif // __ENDPOINTS_H\n";
+		return file;
+	}
+
+	// All eight in one batch, through the handles resolved when the endpoints were generated.
+	// In the order of errorHandles, an entry is INVALID if it could not be read.
+	std::vector<EndpointValue> readErrors() {
+		std::vector<std::pair<uint16_t, EndpointValueType>> requests;
+		std::vector<size_t> indices;
+		for (size_t i = 0; i < errorHandles.size(); i++) {
+			if (isCurrent(errorHandles[i])) {
+				requests.emplace_back(errorHandles[i].id, errorHandles[i].type);
+				indices.push_back(i);
+			}
+		}
 
-		Battery::SaveFileWithDialog("h", file, Battery::GetMainWindow());
+		std::vector<EndpointValue> errors(errorHandles.size());
+		auto values = readMany(requests);
+		for (size_t i = 0; i < values.size(); i++) {
+			errors[indices[i]] = values[i];
+		}
+		return errors;
 	}
 
-	void updateErrors() {
-		read<int32_t>("axis0.error", &axis0Error);
-		read<int32_t>("axis0.motor.error", &motor0Error);
-		read<int32_t>("axis0.encoder.error", &encoder0Error);
-		read<int32_t>("axis0.controller.error", &controller0Error);
-		read<int32_t>("axis1.error", &axis1Error);
-		read<int32_t>("axis1.motor.error", &motor1Error);
-		read<int32_t>("axis1.encoder.error", &encoder1Error);
-		read<int32_t>("axis1.controller.error", &controller1Error);
+	// Takes over what readErrors() returned, on the thread that draws the errors
+	void setErrors(const std::vector<EndpointValue>& errors) {
+		std::array<int32_t*, 8> targets = { &axis0Error, &motor0Error, &encoder0Error, &controller0Error,
+											&axis1Error, &motor1Error, &encoder1Error, &controller1Error };
+
+		for (size_t i = 0; i < std::min(errors.size(), targets.size()); i++) {
+			if (errors[i].type() != EndpointValueType::INVALID) {
+				*targets[i] = errors[i].get<int32_t>();
+			}
+		}
 
 		error = axis0Error || motor0Error || encoder0Error || controller0Error || 
 			    axis1Error || motor1Error || encoder1Error || controller1Error;
 	}
 
 	uint64_t getSerialNumber() {
-		read<uint64_t>("serial_number", &serialNumber);
+		read<uint64_t>(serialNumberHandle, &serialNumber);
 		return serialNumber;
 	}
 
+	bool readVbusVoltage(float* voltage) {
+		return read<float>(vbusVoltageHandle, voltage);
+	}
+
 	void load(int odriveID) {
 
-		std::lock_guard<std::mutex> lock(transferMutex);
 		connected = true;
-		json = getJSON();
-		jsonCRC = CRC16_JSON((uint8_t*)&json[0], json.length());
-		setODriveID(odriveID);
+		this->odriveID = odriveID;
+
+		std::string descriptor;		// Only kept until it is stored in the cache
+		bool cached = loadFromCache();
+		if (!cached && !downloadEndpoints(descriptorCache ? &descriptor : nullptr)) {
+			disconnect();
+		}
 
 		if (!connected)
 			return;
 
 		loaded = true;
-		LOG_DEBUG("ODrive JSON CRC is 0x{:04X}", jsonCRC);
+		LOG_DEBUG("ODrive JSON CRC is 0x{:04X}{}", jsonCRC, cached ? " (from cache)" : "");
+
+		if (!cached) {
+			storeInCache(descriptor);
+		}
+	}
+
+	std::string getFirmwareVersion() {
+		uint8_t major = 0;
+		uint8_t minor = 0;
+		uint8_t revision = 0;
+		read<uint8_t>("fw_version_major", &major);
+		read<uint8_t>("fw_version_minor", &minor);
+		read<uint8_t>("fw_version_revision", &revision);
+		return std::to_string(major) + "." + std::to_string(minor) + "." + std::to_string(revision);
 	}
 
+	// The endpoints do not depend on the slot, only the full paths derived from them, so this is free
 	void setODriveID(int odriveID) {
-		// Reload the cache
-		generateEndpoints(odriveID);
+		this->odriveID = odriveID;
 	}
 
-	operator bool() {
-		return (bool)(connected && device && loaded);
+	// e.g. "odrv0.axis0.motor.error"
+	std::string getFullPath(uint32_t index) {
+		return "odrv" + std::to_string(odriveID.load()) + "." + endpoints->getIdentifier(index);
 	}
 
-private:
-	void disconnect() {
-		connected = false;
-		device->close();
+	// Queue a read request without waiting for it, the response is collected with awaitResponse().
+	// Any number of reads can be submitted back to back, at most maxInFlight are on the wire at once.
+	// If a target is given, the response is decoded directly into it.
+	std::shared_ptr<PendingRequest> submitRead(uint16_t endpoint, uint16_t size, void* target = nullptr) {
+		if (!isAvailable())
+			return nullptr;
+
+		return submitRequest(endpoint, size, nullptr, 0, jsonCRC, target);
 	}
 
-	void generateEndpoints(int odriveID) {
+	// Block until the request completed or its deadline passed, returns true if a response was received.
+	// The deadline adapts to the round trip times measured on this device.
+	bool awaitResponse(const std::shared_ptr<PendingRequest>& request) {
+		return awaitResponse(request, demux.getDeadline(ODRIVE_TIMEOUT));
+	}
 
-		endpoints.clear();
-		cachedEndpoints.clear();
+	bool awaitResponse(const std::shared_ptr<PendingRequest>& request, double timeout) {
+		if (!demux.wait(request, timeout))
+			return false;
 
-		try {
+		breaker.recordSuccess();
+		return true;
+	}
 
-			for (auto& subnode : njson::parse(json)) {
-				if (subnode["type"] == "json") {
-					// Ignore the json endpoint (endpoint 0)
-					continue;
-				}
+	// Give up on a submitted request nobody is going to wait for, so it does not hold its slot in the window
+	void cancel(const std::shared_ptr<PendingRequest>& request) {
+		demux.cancel(request);
+	}
+
+	// Submit a request and wait for it, submitting it again whenever the deadline passes. The deadline doubles
+	// with every retry and all attempts together never take longer than ODRIVE_TIMEOUT. Returns nullptr on failure,
+	// right away if the device is disconnected meanwhile or stopped responding to other requests.
+	template<typename F>
+	std::shared_ptr<PendingRequest> requestWithRetries(F submit) {
+		auto start = std::chrono::steady_clock::now();
+		double deadline = demux.getDeadline(ODRIVE_TIMEOUT);
+
+		for (int attempt = 0; attempt <= ODRIVE_MAX_RETRIES; attempt++) {
+			double remaining = ODRIVE_TIMEOUT - std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			if (remaining <= 0 || breaker.isOpen())
+				break;
+
+			auto request = submit();
+			if (!request)
+				return nullptr;
+
+			double timeout = (attempt == ODRIVE_MAX_RETRIES) ? remaining : std::min(deadline, remaining);
+			if (awaitResponse(request, timeout))
+				return request;
 
-				endpoints.push_back(makeNode(subnode, "", odriveID));
+			if (request->error == RequestError::CANCELLED || !connected) {
+				LOG_DEBUG("Request with sequence number {} was cancelled, odrv{} is disconnected", request->sequence, odriveID.load());
+				return nullptr;
 			}
+
+			deadline *= 2;
+			LOG_TRACE("No response for sequence number {}, retrying", request->sequence);
 		}
-		catch (...) {
-			LOG_ERROR("Error while parsing json definition!");
-			disconnect();
-			endpoints.clear();
-			cachedEndpoints.clear();
+
+		if (loaded && breaker.recordFailure()) {
+			LOG_WARN("odrv{} is not responding, requests fail right away until it answers again", odriveID.load());
 		}
+		return nullptr;
 	}
 
-	Endpoint makeNode(njson node, const std::string& parentPath, int odriveID) {
+	// False while the device is disconnected or not responding, every request fails right away then.
+	// A device that is not responding is probed in the background, with a growing interval.
+	bool isAvailable() {
+		if (!loaded || !connected)
+			return false;
 
-		Endpoint ep;
-		ep->name = node["name"];
-		ep->identifier = ((parentPath.size() > 0) ? (parentPath + ".") : ("")) + ep->name;
-		ep->fullPath = "odrv" + std::to_string(odriveID) + "." + ep->identifier;
-		ep->type = node["type"];
-		ep->odriveID = odriveID;
+		if (!breaker.isOpen())
+			return true;
 
-		if (ep->type == "object") {			// Object with children
-			for (auto& subnode : node["members"]) {
-				ep.children.push_back(makeNode(subnode, ep->identifier, odriveID));
-			}
+		if (breaker.shouldProbe()) {
+			worker.submit([this] { probe(); });
 		}
-		else if (ep->type == "function") {	// Function
-			ep->id = node["id"];
+		return false;
+	}
 
-			for (auto& input : node["inputs"]) {
-				ep.inputs.push_back(makeNode(input, ep->identifier, odriveID));
-			}
-			for (auto& output : node["outputs"]) {
-				ep.outputs.push_back(makeNode(output, ep->identifier, odriveID));
-			}
-			cachedEndpoints.push_back(ep.basic);
+	bool isResponding() {
+		return !breaker.isOpen();
+	}
+
+	// Called once when the transport failed or the device was closed, from whatever thread noticed it
+	void setDisconnectCallback(std::function<void()> callback) {
+		std::lock_guard<std::mutex> lock(disconnectMutex);
+		disconnectCallback = std::move(callback);
+	}
+
+	DemultiplexerStats getResponseStats() {
+		return demux.getStats();
+	}
+
+	operator bool() {
+		return (bool)(connected && transport && loaded);
+	}
+
+	EndpointHandle findEndpoint(const std::string& identifier) {
+
+		if (!loaded)
+			return EndpointHandle();
+
+		EndpointHandle handle = resolve(identifier);
+		if (!handle) {
+			LOG_ERROR("Endpoint '{}' was not found in the cache", identifier);
 		}
-		else {						// All other numeric types
-			ep->id = node["id"];
-			ep->readonly = (node["access"] == "r");
-			cachedEndpoints.push_back(ep.basic);
+		return handle;
+	}
+
+	// Look up an endpoint once and keep the handle, it stays valid until the JSON definition changes.
+	// Objects have no value, so they cannot be resolved.
+	EndpointHandle resolve(const std::string& identifier) {
+		EndpointHandle handle;
+		uint32_t index = endpoints->find(identifier);
+		if (index != ENDPOINT_NONE && endpoints->getType(index) != EndpointType::OBJECT) {
+			handle.id = endpoints->getId(index);
+			handle.jsonCRC = jsonCRC;
+			handle.type = getValueType(endpoints->getType(index));
+			handle.valid = true;
 		}
+		return handle;
+	}
 
-		return ep;
+	bool isCurrent(const EndpointHandle& handle) {
+		return handle.valid && handle.jsonCRC == jsonCRC;
 	}
 
-	BasicEndpoint* findEndpoint(const std::string& identifier) {
+private:
+	// Can be called from the transport threads, the device itself is closed in the destructor.
+	// Everything still waiting for a response is cancelled, so nobody sits out the timeout of a device that is gone.
+	void disconnect() {
+		if (!connected.exchange(false))
+			return;
 
-		if (!loaded)
-			return nullptr;
+		transport->stop();
+		demux.close();
+
+		std::function<void()> callback;
+		{
+			std::lock_guard<std::mutex> lock(disconnectMutex);
+			callback = disconnectCallback;
+		}
+		if (callback) {
+			callback();
+		}
+	}
+
+	// Runs on the worker: A single read of the serial number, not retried, the breaker decides when to try again
+	void probe() {
+		bool success = false;
+		if (connected && isCurrent(serialNumberHandle)) {
+			auto request = submitRequest(serialNumberHandle.id, sizeof(uint64_t), nullptr, 0, jsonCRC);
+			success = request && demux.wait(request, ODRIVE_TIMEOUT);
+		}
+
+		if (breaker.recordProbe(success)) {
+			LOG_INFO("odrv{} is responding again", odriveID.load());
+		}
+	}
 
-		for (auto& ep : cachedEndpoints) {
-			if (ep.identifier == identifier) {
-				return &ep;
+	// Try the schemas of the other devices and the cached descriptors: The device only answers a request carrying
+	// its own JSON CRC and silently drops the others, so a single read of the serial number per candidate tells
+	// which one (if any) is valid. The serial number itself cannot be read before that, so the most likely candidate
+	// is tried alone and only a miss falls back to the others, a few at a time.
+	bool loadFromCache() {
+
+		std::vector<CachedDescriptorInfo> candidates;
+		for (auto& [jsonCRC, serialNumberEndpoint] : EndpointSchemas::getCandidates()) {	// In memory already, no parsing needed
+			CachedDescriptorInfo info;
+			info.jsonCRC = jsonCRC;
+			info.serialNumberEndpoint = serialNumberEndpoint;
+			candidates.push_back(info);
+		}
+		if (descriptorCache) {
+			for (auto& info : descriptorCache->getCandidates()) {
+				if (std::none_of(candidates.begin(), candidates.end(), [&](auto& c) { return c.jsonCRC == info.jsonCRC; })) {
+					candidates.push_back(info);
+				}
 			}
 		}
 
-		LOG_ERROR("Endpoint '{}' was not found in the cache", identifier);
-		return nullptr;
+		size_t batch = 1;
+		for (size_t first = 0; first < candidates.size(); first += batch, batch = ODRIVE_PROBE_BATCH) {
+			size_t count = std::min(batch, candidates.size() - first);
+
+			std::vector<std::shared_ptr<PendingRequest>> probes;
+			for (size_t i = first; i < first + count; i++) {
+				probes.push_back(submitRequest(candidates[i].serialNumberEndpoint, sizeof(uint64_t), nullptr, 0, candidates[i].jsonCRC));
+			}
+
+			int match = -1;
+			bool responding = awaitProbes(probes, &match);
+			if (match >= 0 && probes[match]->responseSize == sizeof(uint64_t)) {
+				memcpy(&serialNumber, probes[match]->response, sizeof(uint64_t));
+			}
+			else {
+				match = -1;
+			}
+			for (auto& probe : probes) {		// The dropped ones would otherwise hold their slot in the window forever
+				demux.cancel(probe);
+			}
+
+			if (match >= 0)
+				return useCandidate(candidates[first + match]);		// No other candidate can match anymore
+
+			if (!responding)
+				return false;
+		}
+
+		return false;
 	}
 
-	uint16_t sendReadRequest(uint16_t endpointID, uint16_t expectedResponseSize, const buffer_t& payload, uint16_t jsonCRC) {
-		return sendRequest((1 << 15) | endpointID, expectedResponseSize, payload, jsonCRC);
+	// Waits for the probes sent right before: A chunk of the JSON definition is requested after them, which the device
+	// answers whatever its CRC. Requests are answered in order, so a probe without a response by then never gets one.
+	// Sets 'match' to the index of the probe that was answered, returns false if the device did not respond at all.
+	bool awaitProbes(const std::vector<std::shared_ptr<PendingRequest>>& probes, int* match) {
+		uint32_t offset = 0;
+		auto start = std::chrono::steady_clock::now();
+		auto ping = submitRequest(0, ODRIVE_JSON_CHUNK_SIZE, (const uint8_t*)&offset, sizeof(offset), 1);
+		if (!ping || !demux.wait(ping, ODRIVE_TIMEOUT)) {
+			*match = demux.waitAny(probes, 0.0);
+			return false;
+		}
+
+		double roundTrip = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		*match = demux.waitAny(probes, roundTrip);		// Another round trip of grace, for links that reorder responses
+		return true;
 	}
 
-	uint16_t sendWriteRequest(uint16_t endpointID, uint16_t expectedResponseSize, const buffer_t& payload, uint16_t jsonCRC) {
-		return sendRequest(endpointID, expectedResponseSize, payload, jsonCRC);
+	// Takes over the endpoints of a candidate the device answered
+	bool useCandidate(const CachedDescriptorInfo& candidate) {
+
+		jsonCRC = candidate.jsonCRC;
+		auto schema = EndpointSchemas::find(jsonCRC);
+		if (schema) {
+			useEndpoints(schema);
+			return true;
+		}
+
+		std::string descriptor = descriptorCache ? descriptorCache->loadDescriptor(candidate) : "";
+		if (descriptor.empty())
+			return false;
+
+		auto table = std::make_shared<EndpointTable>();
+		DescriptorParser parser(*table);
+		parser.feed(descriptor.data(), descriptor.length());
+		return finishEndpoints(parser, table);
 	}
 
-	uint16_t sendRequest(uint16_t endpointID, uint16_t expectedResponseSize, const buffer_t& payload, uint16_t jsonCRC) {
-		sequenceNumber = (sequenceNumber + 1) % 4096;
-		if (sendRequest(sequenceNumber, endpointID, expectedResponseSize, payload, jsonCRC))
-			return sequenceNumber;
-		else
-			return -1;
+	void storeInCache(const std::string& descriptor) {
+
+		if (!descriptorCache)
+			return;
+
+		auto serialNumberEndpoint = findEndpoint("serial_number");
+		if (!serialNumberEndpoint)
+			return;
+
+		CachedDescriptorInfo info;
+		info.serialNumber = getSerialNumber();
+		info.firmwareVersion = getFirmwareVersion();
+		info.jsonCRC = jsonCRC;
+		info.serialNumberEndpoint = serialNumberEndpoint.id;
+		if (info.serialNumber != 0) {
+			descriptorCache->store(info, descriptor);
+		}
 	}
 
-	bool sendRequest(uint16_t sequenceNumber, uint16_t endpointID, uint16_t expectedResponseSize, const buffer_t& payload, uint16_t jsonCRC) {
-		buffer_t buffer;
-		buffer.reserve(payload.size() + 8);
+	// Called once the whole definition went through the parser. The table is shared from here on.
+	bool finishEndpoints(DescriptorParser& parser, std::shared_ptr<EndpointTable> table) {
 
-		buffer.push_back((uint8_t)(sequenceNumber));
-		buffer.push_back((uint8_t)(sequenceNumber >> 8));
+		if (!parser.finish()) {
+			LOG_ERROR("Error while parsing json definition: {}", parser.getError());
+			return false;
+		}
+		LOG_DEBUG("{} endpoints take {} bytes", table->size(), table->getMemoryUsage());
 
-		buffer.push_back((uint8_t)(endpointID));
-		buffer.push_back((uint8_t)(endpointID >> 8));
+		useEndpoints(EndpointSchemas::share(jsonCRC, std::move(table)));
+		return true;
+	}
 
-		buffer.push_back((uint8_t)(expectedResponseSize));
-		buffer.push_back((uint8_t)(expectedResponseSize >> 8));
+	void useEndpoints(std::shared_ptr<const EndpointTable> table) {
 
-		for (uint8_t b : payload) {
-			buffer.push_back(b);
+		endpoints = std::move(table);
+		serialNumberHandle = resolve("serial_number");
+		vbusVoltageHandle = resolve("vbus_voltage");
+		const char* errors[] = { "axis0.error", "axis0.motor.error", "axis0.encoder.error", "axis0.controller.error",
+								 "axis1.error", "axis1.motor.error", "axis1.encoder.error", "axis1.controller.error" };
+		for (size_t i = 0; i < errorHandles.size(); i++) {
+			errorHandles[i] = resolve(errors[i]);
 		}
+	}
 
-		buffer.push_back((uint8_t)(jsonCRC));
-		buffer.push_back((uint8_t)(jsonCRC >> 8));
+	// Register an acknowledged request with the demultiplexer and send it. Blocks while the in-flight window is full.
+	std::shared_ptr<PendingRequest> submitRequest(uint16_t endpointID, uint16_t expectedResponseSize, 
+		const uint8_t* payload, size_t payloadSize, uint16_t jsonCRC, void* target = nullptr) {
+
+		auto request = demux.acquire(expectedResponseSize, target);
+		if (!connected || !demux.add(request, ODRIVE_TIMEOUT)) {
+			return nullptr;
+		}
 
-		return write(&buffer[0], buffer.size());
+		if (!sendRequest(request->sequence, (1 << 15) | endpointID, expectedResponseSize, payload, payloadSize, jsonCRC)) {
+			return nullptr;
+		}
+		return request;
 	}
 
-	bool write(uint8_t* data, size_t length) {
-		for (int i = 0; i < 5; i++) {
-			if (device->bulkWrite(data, length, ODRIVE_USB_WRITE_ENDPOINT) != -1) {
-				return true;
-			}
+	// Runs on the receiving transport thread: Hands every response to whoever is waiting for that sequence number.
+	// The payload is passed on in place, without copying it out of the received packet.
+	void onPacket(const uint8_t* data, size_t length) {
+		if (length >= 2) {
+			uint16_t sequence = data[0] | data[1] << 8;
+			demux.dispatch(sequence, data + 2, length - 2);
 		}
-		disconnect();
-		return false;
 	}
 
-	std::vector<uint8_t> read(size_t expectedLength) {
-		auto data = device->bulkRead(expectedLength + 2, ODRIVE_USB_READ_ENDPOINT);
-		if (data.size() == 0) {
-			disconnect();
+	bool writeRaw(uint16_t endpoint, const uint8_t* payload, size_t payloadSize, WriteMode mode) {
+		if (mode == WriteMode::UNACKNOWLEDGED) {
+			return sendWriteRequest(endpoint, 0, payload, payloadSize, jsonCRC) != ODRIVE_NO_SEQUENCE;
 		}
-		return data;
+		return requestWithRetries([&] { return submitRequest(endpoint, 0, payload, payloadSize, jsonCRC); }) != nullptr;
 	}
 
-	std::pair<uint16_t, buffer_t> getResponse(size_t expectedLength) {
-		buffer_t response = read(expectedLength);
+	uint16_t sendWriteRequest(uint16_t endpointID, uint16_t expectedResponseSize, const uint8_t* payload, size_t payloadSize, uint16_t jsonCRC) {
+		uint16_t sequence = demux.allocateSequence();
+		if (sendRequest(sequence, endpointID, expectedResponseSize, payload, payloadSize, jsonCRC))
+			return sequence;
+		else
+			return ODRIVE_NO_SEQUENCE;
+	}
 
-		if (response.size() < 2) {
-			return std::make_pair(0, buffer_t());
+	// The frame is built on the stack, a request is never larger than one USB packet
+	bool sendRequest(uint16_t sequenceNumber, uint16_t endpointID, uint16_t expectedResponseSize, 
+		const uint8_t* payload, size_t payloadSize, uint16_t jsonCRC) {
+
+		std::array<uint8_t, ODRIVE_MAX_FRAME_SIZE> frame;
+		if (payloadSize + 8 > frame.size()) {
+			LOG_ERROR("Request payload of {} bytes does not fit into one packet", payloadSize);
+			return false;
 		}
 
-		uint16_t sequence = response[0] | response[1] << 8;
+		frame[0] = (uint8_t)(sequenceNumber);
+		frame[1] = (uint8_t)(sequenceNumber >> 8);
+
+		frame[2] = (uint8_t)(endpointID);
+		frame[3] = (uint8_t)(endpointID >> 8);
 
-		buffer_t buffer;
-		for (size_t i = 2; i < response.size(); i++) {
-			buffer.push_back(response[i]);
+		frame[4] = (uint8_t)(expectedResponseSize);
+		frame[5] = (uint8_t)(expectedResponseSize >> 8);
+
+		if (payloadSize > 0) {
+			memcpy(&frame[6], payload, payloadSize);
 		}
-		return std::make_pair(sequence, buffer);
+
+		frame[6 + payloadSize] = (uint8_t)(jsonCRC);
+		frame[7 + payloadSize] = (uint8_t)(jsonCRC >> 8);
+
+		return transport->sendFrame(frame.data(), payloadSize + 8);	// Queued, the transport sends it on its own thread
 	}
 
-	std::string getJSON() {
-		std::string json;
+	// Download the JSON definition and build the endpoints from it. Chunks for increasing offsets are requested ahead
+	// in a sliding window and parsed in order while the next ones are on the way, the CRC is computed along the way.
+	// The text itself is only kept if a copy is asked for.
+	bool downloadEndpoints(std::string* copy) {
+		auto table = std::make_shared<EndpointTable>();
+		DescriptorParser parser(*table);
+		std::deque<std::pair<uint32_t, std::shared_ptr<PendingRequest>>> window;
 
-		uint32_t offset = 0;
+		jsonCRC = 1;	// Initial value of CRC16_JSON
+		uint32_t nextOffset = 0;
 		while (true) {
-			buffer_t buffer(sizeof(offset), 0);
-			memcpy(&buffer[0], &offset, sizeof(offset));
 
-			sendReadRequest(0, 32, buffer, 1);
-			auto response = getResponse(32);
-			offset += (uint32_t)response.second.size();
+			// Keep the window full
+			while (window.size() < ODRIVE_JSON_WINDOW) {
+				auto request = submitRequest(0, ODRIVE_JSON_CHUNK_SIZE, (const uint8_t*)&nextOffset, sizeof(nextOffset), 1);
+				if (!request)
+					break;
+
+				window.emplace_back(nextOffset, request);
+				nextOffset += ODRIVE_JSON_CHUNK_SIZE;
+			}
 
-			if (response.second.size() == 0) {
+			if (window.empty())
 				break;
+
+			auto [offset, request] = window.front();
+			window.pop_front();
+
+			if (!awaitResponse(request)) {		// Lost chunk, ask for it again before giving up
+				request = requestWithRetries([&] { return submitRequest(0, ODRIVE_JSON_CHUNK_SIZE, (const uint8_t*)&offset, sizeof(offset), 1); });
+				if (!request) {
+					LOG_ERROR("Failed to download the JSON definition at offset {}", offset);
+					break;
+				}
 			}
 
-			json += std::string((char*)&response.second[0], response.second.size());
+			parser.feed((const char*)request->response, request->responseSize);
+			jsonCRC = CRC16_JSON_Update(jsonCRC, request->response, request->responseSize);
+			if (copy) {
+				copy->append((const char*)request->response, request->responseSize);
+			}
+
+			if (request->responseSize < ODRIVE_JSON_CHUNK_SIZE) {	// The last chunk, the rest of the window is simply dropped
+				break;
+			}
 		}
 
-		return json;
+		return finishEndpoints(parser, table);
 	}
 
-	libusbcpp::device device;
-	inline static uint16_t sequenceNumber = 0;
-	std::mutex transferMutex;
+	std::unique_ptr<Transport> transport;
+	DescriptorCache* descriptorCache = nullptr;
+
+	ResponseDemultiplexer demux;	// Per-device sequence space and pending requests
+	WriteQueue writeQueue;
+	IoWorker worker;				// Runs the batched reads of this device
+	CircuitBreaker breaker;			// Opens after repeated timeouts
+
+	std::function<void()> disconnectCallback;
+	std::mutex disconnectMutex;
+
+	EndpointHandle serialNumberHandle;
+	EndpointHandle vbusVoltageHandle;
+	std::array<EndpointHandle, 8> errorHandles;		// axis, motor, encoder and controller errors of axis0, then axis1
 };
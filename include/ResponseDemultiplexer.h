@@ -0,0 +1,292 @@
+#pragma once
+
+#include "pch.h"
+#include "LatencyEstimator.h"
+
+#include <chrono>
+#include <condition_variable>
+
+#define ODRIVE_SEQUENCE_MASK 0x7FFF				// The MSB of the sequence number marks a response
+#define ODRIVE_DEFAULT_MAX_IN_FLIGHT 16			// Number of acknowledged requests that may be pending at once
+#define ODRIVE_PENDING_TABLE_SIZE 64			// Upper limit for the in-flight window
+#define ODRIVE_REORDER_BUFFER_SIZE 32			// Number of timed out requests that can still be completed by a late response
+#define ODRIVE_COMPLETED_HISTORY_SIZE 64		// Number of completed sequence numbers remembered to detect duplicates
+#define ODRIVE_REQUEST_POOL_SIZE 128			// Preallocated request slots, more are only allocated if all are in use
+#define ODRIVE_MAX_RESPONSE_SIZE 64
+
+#define ODRIVE_NO_SEQUENCE 0xFFFF
+
+typedef std::vector<uint8_t> buffer_t;
+
+enum class RequestError {
+	NONE,
+	TIMEOUT,		// No response before the deadline, a retry may still succeed
+	CANCELLED		// The device is gone, retrying is pointless
+};
+
+// One acknowledged request waiting for its response. The response is stored inline,
+// or decoded straight into the caller's storage if a target is given.
+struct PendingRequest {
+	uint16_t sequence = 0;
+	uint16_t expectedResponseSize = 0;
+	void* target = nullptr;			// Receives the payload if it has exactly expectedResponseSize bytes
+	bool done = false;
+	bool success = false;
+	RequestError error = RequestError::NONE;
+	uint8_t response[ODRIVE_MAX_RESPONSE_SIZE];
+	size_t responseSize = 0;
+	std::chrono::steady_clock::time_point sent;
+};
+
+struct DemultiplexerStats {
+	uint64_t matched = 0;		// Response arrived while somebody was waiting for it
+	uint64_t stale = 0;			// Response arrived after its request timed out
+	uint64_t duplicate = 0;		// Response for a sequence number that was already completed
+	uint64_t unmatched = 0;		// Response for a sequence number that was never issued or long forgotten
+	double roundTripTime = 0.0;	// p99 in seconds, 0 until enough responses were seen
+};
+
+// Owns the sequence space of one device and hands incoming responses to the requests waiting for them.
+// Requests that time out are kept in a bounded reorder buffer, so a late response still completes them
+// instead of being mistaken for the reply to a newer request.
+class ResponseDemultiplexer {
+public:
+
+	ResponseDemultiplexer() {
+		completed.fill(ODRIVE_NO_SEQUENCE);
+		pool.reserve(ODRIVE_REQUEST_POOL_SIZE);
+		for (size_t i = 0; i < ODRIVE_REQUEST_POOL_SIZE; i++) {
+			pool.push_back(std::make_shared<PendingRequest>());
+		}
+	}
+
+	// Hand out a recycled request slot. A slot is free when nobody but the pool holds a reference to it.
+	std::shared_ptr<PendingRequest> acquire(uint16_t expectedResponseSize, void* target = nullptr) {
+		std::shared_ptr<PendingRequest> request;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			for (size_t i = 0; i < pool.size(); i++) {
+				auto& slot = pool[(poolCursor + i) % pool.size()];
+				if (slot.use_count() == 1) {
+					request = slot;
+					poolCursor = (poolCursor + i + 1) % pool.size();
+					break;
+				}
+			}
+		}
+		if (!request) {
+			request = std::make_shared<PendingRequest>();
+		}
+
+		request->sequence = 0;
+		request->expectedResponseSize = expectedResponseSize;
+		request->target = target;
+		request->done = false;
+		request->success = false;
+		request->error = RequestError::NONE;
+		request->responseSize = 0;
+		return request;
+	}
+
+	// Allocate a sequence number and register the request. Blocks while the in-flight window is full.
+	bool add(const std::shared_ptr<PendingRequest>& request, double timeout) {
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			auto windowOpen = [&] { return closed || pendingCount < maxInFlight; };
+			if (!condition.wait_for(lock, std::chrono::duration<double>(timeout), windowOpen) || closed) {
+				request->error = closed ? RequestError::CANCELLED : RequestError::TIMEOUT;
+				return false;
+			}
+			do {	// Skip sequence numbers whose slot is still taken by an old request
+				request->sequence = allocateSequenceLocked();
+			} while (pending[request->sequence % ODRIVE_PENDING_TABLE_SIZE]);
+			pending[request->sequence % ODRIVE_PENDING_TABLE_SIZE] = request;
+			pendingCount++;
+			request->sent = std::chrono::steady_clock::now();
+		}
+		condition.notify_all();		// Wake up the reader
+		return true;
+	}
+
+	// Sequence number for a request that does not expect a response
+	uint16_t allocateSequence() {
+		std::lock_guard<std::mutex> lock(mutex);
+		return allocateSequenceLocked();
+	}
+
+	// How long to wait for the next response, derived from the round trip times seen so far
+	double getDeadline(double fallback) {
+		std::lock_guard<std::mutex> lock(mutex);
+		return latency.getDeadline(fallback);
+	}
+
+	// Block until the request completed, timed out or was cancelled, returns true if a response was received.
+	// Can be called again on a request that timed out, in case the response arrived late.
+	bool wait(const std::shared_ptr<PendingRequest>& request, double timeout) {
+		if (!request)
+			return false;
+
+		std::unique_lock<std::mutex> lock(mutex);
+		if (!condition.wait_for(lock, std::chrono::duration<double>(timeout), [&] { return request->done; })) {
+			request->error = RequestError::TIMEOUT;
+			request->target = nullptr;		// The caller's storage is gone after returning
+			auto& slot = pending[request->sequence % ODRIVE_PENDING_TABLE_SIZE];
+			if (slot == request) {
+				slot.reset();
+				pendingCount--;
+				abandoned[abandonedCursor] = request;	// Overwrites the oldest one
+				abandonedCursor = (abandonedCursor + 1) % ODRIVE_REORDER_BUFFER_SIZE;
+			}
+			lock.unlock();
+			condition.notify_all();		// A slot in the window is free again
+			return false;
+		}
+		return request->success;
+	}
+
+	// Block until one of the requests received a response, returns its index or -1 after the timeout.
+	// The others stay pending, cancel the ones nobody is going to wait for.
+	int waitAny(const std::vector<std::shared_ptr<PendingRequest>>& requests, double timeout) {
+		int index = -1;
+		std::unique_lock<std::mutex> lock(mutex);
+		condition.wait_for(lock, std::chrono::duration<double>(timeout), [&] {
+			for (size_t i = 0; i < requests.size(); i++) {
+				if (requests[i] && requests[i]->done && requests[i]->success) {
+					index = (int)i;
+					return true;
+				}
+			}
+			return closed;
+		});
+		return index;
+	}
+
+	// Give up on a request that may never be answered, e.g. one the device dropped. Its slot in the window is
+	// freed right away and a response arriving later counts as unmatched. Does nothing if it already completed.
+	void cancel(const std::shared_ptr<PendingRequest>& request) {
+		if (!request)
+			return;
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (request->done)
+				return;
+
+			auto& slot = pending[request->sequence % ODRIVE_PENDING_TABLE_SIZE];
+			if (slot == request) {
+				slot.reset();
+				pendingCount--;
+			}
+			std::replace(abandoned.begin(), abandoned.end(), request, std::shared_ptr<PendingRequest>());
+			request->error = RequestError::CANCELLED;
+			request->target = nullptr;
+			request->done = true;
+		}
+		condition.notify_all();
+	}
+
+	// Called by the reader with every response received from the device, the payload is only borrowed
+	void dispatch(uint16_t sequence, const uint8_t* payload, size_t length) {
+		sequence &= ODRIVE_SEQUENCE_MASK;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+
+			auto& slot = pending[sequence % ODRIVE_PENDING_TABLE_SIZE];
+			auto late = std::find_if(abandoned.begin(), abandoned.end(), [&](auto& r) { return r && r->sequence == sequence; });
+			if (slot && slot->sequence == sequence) {
+				complete(*slot, payload, length);
+				slot.reset();
+				pendingCount--;
+				stats.matched++;
+			}
+			else if (late != abandoned.end()) {
+				complete(**late, payload, length);
+				late->reset();
+				stats.stale++;
+				LOG_TRACE("Late response for sequence number {}", sequence);
+			}
+			else if (std::find(completed.begin(), completed.end(), sequence) != completed.end()) {
+				stats.duplicate++;
+				LOG_TRACE("Duplicate response for sequence number {}", sequence);
+				return;
+			}
+			else {
+				stats.unmatched++;
+				LOG_TRACE("Unmatched response for sequence number {}", sequence);
+				return;
+			}
+
+			completed[completedCursor] = sequence;
+			completedCursor = (completedCursor + 1) % ODRIVE_COMPLETED_HISTORY_SIZE;
+		}
+		condition.notify_all();
+	}
+
+	// Cancel everything that is pending and reject all new requests. Whoever waits returns right away.
+	void close() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			closed = true;
+			for (auto& request : pending) {
+				if (request) {
+					request->error = RequestError::CANCELLED;
+					request->done = true;
+					request.reset();
+				}
+			}
+			for (auto& request : abandoned) {
+				if (request) {
+					request->error = RequestError::CANCELLED;
+				}
+			}
+			pendingCount = 0;
+			abandoned.fill(nullptr);
+		}
+		condition.notify_all();
+	}
+
+	DemultiplexerStats getStats() {
+		std::lock_guard<std::mutex> lock(mutex);
+		stats.roundTripTime = latency.getPercentile();
+		return stats;
+	}
+
+private:
+	uint16_t allocateSequenceLocked() {
+		uint16_t sequence = nextSequence;
+		nextSequence = (nextSequence + 1) & ODRIVE_SEQUENCE_MASK;
+		return sequence;
+	}
+
+	// Late responses are sampled as well, otherwise a slow device would keep timing out on a deadline that is too short
+	void complete(PendingRequest& request, const uint8_t* payload, size_t length) {
+		latency.addSample(std::chrono::duration<double>(std::chrono::steady_clock::now() - request.sent).count());
+
+		request.responseSize = std::min<size_t>(length, ODRIVE_MAX_RESPONSE_SIZE);
+		memcpy(request.response, payload, request.responseSize);
+		if (request.target && length == request.expectedResponseSize) {
+			memcpy(request.target, payload, length);
+		}
+		request.success = true;
+		request.done = true;
+	}
+
+	// Fixed size tables, nothing is allocated per request once the pool is warm
+	std::array<std::shared_ptr<PendingRequest>, ODRIVE_PENDING_TABLE_SIZE> pending;		// Indexed by sequence number
+	size_t pendingCount = 0;
+	std::array<std::shared_ptr<PendingRequest>, ODRIVE_REORDER_BUFFER_SIZE> abandoned;	// Timed out, but a late response is still accepted
+	size_t abandonedCursor = 0;
+	std::array<uint16_t, ODRIVE_COMPLETED_HISTORY_SIZE> completed;
+	size_t completedCursor = 0;
+	std::vector<std::shared_ptr<PendingRequest>> pool;
+	size_t poolCursor = 0;
+	DemultiplexerStats stats;
+	LatencyEstimator latency;
+
+	uint16_t nextSequence = 0;
+	const size_t maxInFlight = ODRIVE_DEFAULT_MAX_IN_FLIGHT;
+	bool closed = false;
+
+	std::mutex mutex;
+	std::condition_variable condition;
+};
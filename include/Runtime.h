@@ -0,0 +1,89 @@
+#pragma once
+
+// The protocol stack (transports, demultiplexer, ODrive and SoftwareODrive) only needs a clock and logging from
+// the application. The GUI takes both from BatteryEngine. Built with ODRIVE_NO_BATTERY, e.g. for the tests and
+// benchmarks on a machine without the engine, the clock is std::chrono::steady_clock and log messages go to a
+// sink that the program can replace.
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef ODRIVE_NO_BATTERY
+#include <fmt/format.h>
+#else
+#include "Battery/Battery.h"
+#endif
+
+namespace Runtime {
+
+	// Seconds since an arbitrary point, only differences mean anything
+	inline double getTime() {
+#ifdef ODRIVE_NO_BATTERY
+		static const auto start = std::chrono::steady_clock::now();
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+#else
+		return Battery::GetRuntime();
+#endif
+	}
+
+}
+
+#ifdef ODRIVE_NO_BATTERY
+
+namespace Runtime {
+
+	enum class LogLevel {		// Not TRACE, DEBUG, ... which clash with the build defines
+		Trace,
+		Debug,
+		Info,
+		Warning,
+		Error
+	};
+
+	using LogSink = std::function<void(LogLevel level, const std::string& message)>;
+
+	// Warnings and errors go to stderr until the program sets its own sink
+	inline LogSink& getLogSink() {
+		static LogSink sink = [](LogLevel level, const std::string& message) {
+			if (level >= LogLevel::Warning) {
+				fmt::print(stderr, "{}\n", message);
+			}
+		};
+		return sink;
+	}
+
+	inline void setLogSink(LogSink sink) {
+		getLogSink() = std::move(sink);
+	}
+
+	template<typename... Args>
+	void log(LogLevel level, fmt::format_string<Args...> format, Args&&... args) {
+		auto& sink = getLogSink();
+		if (sink) {
+			sink(level, fmt::format(format, std::forward<Args>(args)...));
+		}
+	}
+
+}
+
+#define LOG_TRACE(...)	Runtime::log(Runtime::LogLevel::Trace, __VA_ARGS__)
+#define LOG_DEBUG(...)	Runtime::log(Runtime::LogLevel::Debug, __VA_ARGS__)
+#define LOG_INFO(...)	Runtime::log(Runtime::LogLevel::Info, __VA_ARGS__)
+#define LOG_WARN(...)	Runtime::log(Runtime::LogLevel::Warning, __VA_ARGS__)
+#define LOG_ERROR(...)	Runtime::log(Runtime::LogLevel::Error, __VA_ARGS__)
+
+#endif
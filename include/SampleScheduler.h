@@ -0,0 +1,135 @@
+#pragma once
+
+#include "pch.h"
+#include "Entry.h"
+#include "EntryStore.h"
+
+#include <unordered_map>
+#include <unordered_set>
+
+#define SCHEDULER_TRANSACTION_BUDGET 48		// Endpoint reads per device and cycle, everything else waits for the next cycle
+#define SCHEDULER_MAX_WAIT 0.1				// Seconds, upper bound for sleeping between two cycles
+#define SCHEDULER_RATE_SMOOTHING 0.1		// Weight of the newest interval in the achieved rate
+
+struct SchedulerStats {
+	uint64_t cycles = 0;
+	uint64_t reads = 0;
+	uint64_t deferred = 0;			// Due entries that did not fit into the budget of their device
+	uint64_t missedDeadlines = 0;	// Entries sampled more than one period late
+};
+
+// Decides which entries are read in a cycle of the poller. Every entry has its own rate: It is due once its period
+// passed and must be sampled within the next period, its deadline. Due entries are taken earliest deadline first,
+// until the transaction budget of their device is used up, so a fast current loop and a slow temperature can be
+// watched at the same time without a device ever getting more requests than it can answer in a cycle.
+class SampleScheduler {
+public:
+
+	// The entries to read now. With 'all', every entry counts as due, e.g. to show the effect of a write right away.
+	std::vector<std::shared_ptr<Entry>> collectDue(const EntryStore::List& entries, double now, bool all) {
+
+		std::vector<std::shared_ptr<Entry>> due;
+		for (auto& entry : entries) {
+			bool refresh = entry->sampling.refresh.exchange(false);
+			if (entry->getEndpointCount() > 0 && (all || refresh || entry->sampling.nextDue <= now)) {
+				due.push_back(entry);
+			}
+		}
+		std::sort(due.begin(), due.end(), [](auto& a, auto& b) { return getDeadline(*a) < getDeadline(*b); });
+
+		std::unordered_map<int, size_t> used;		// Reads per odrive ID in this cycle
+		std::vector<std::shared_ptr<Entry>> selected;
+		uint64_t deferred = 0;
+		for (auto& entry : due) {
+			size_t& budget = used[entry->endpoint->odriveID];
+			size_t count = entry->getEndpointCount();
+			if (budget > 0 && budget + count > SCHEDULER_TRANSACTION_BUDGET) {		// A single large entry still fits
+				deferred++;
+				if (entry->sampling.nextDue > now) {
+					entry->sampling.refresh = true;		// Only due because of markDue(), still wanted next cycle
+				}
+				continue;
+			}
+			budget += count;
+			selected.push_back(entry);
+		}
+
+		std::lock_guard<std::mutex> lock(mutex);
+		stats.cycles++;
+		stats.deferred += deferred;
+		return selected;
+	}
+
+	// The entries that read any of these endpoints are due in the next cycle, whatever their rate. Any thread may
+	// call this, e.g. the writer to show the effect of a write right away without reading all other entries too.
+	void markDue(const EntryStore::List& entries, const std::unordered_set<std::string>& fullPaths) {
+		std::vector<const BasicEndpoint*> eps;
+		for (auto& entry : entries) {
+			eps.clear();
+			entry->appendEndpoints(eps);
+			if (std::any_of(eps.begin(), eps.end(), [&](auto* ep) { return fullPaths.count(ep->fullPath) > 0; })) {
+				entry->sampling.refresh = true;
+			}
+		}
+	}
+
+	// After the values of an entry were read at 'now'. Only successful reads count towards the achieved rate,
+	// a failed one is not retried before the next period either.
+	void sampled(Entry& entry, double now, bool success) {
+
+		EntrySampling& sampling = entry.sampling;
+		double period = getPeriod(entry);
+
+		if (success && sampling.lastSample > 0.0) {
+			double interval = now - sampling.lastSample;
+			sampling.averageInterval = (sampling.averageInterval > 0.0) ?
+				sampling.averageInterval + SCHEDULER_RATE_SMOOTHING * (interval - sampling.averageInterval) : interval;
+			sampling.achievedRate = (float)(1.0 / std::max(sampling.averageInterval, 1e-6));
+		}
+		if (success) {
+			sampling.lastSample = now;
+		}
+
+		bool missed = (sampling.nextDue > 0.0 && now > getDeadline(entry));
+		if (missed) {
+			sampling.missedDeadlines++;
+		}
+
+		// Keep the phase while on time, start over from now after falling behind instead of catching up in a burst.
+		// Never more than one period ahead, in case the entry was read early or the rate was just raised.
+		double next = sampling.nextDue + period;
+		sampling.nextDue = (next > now) ? std::min(next, now + period) : now + period;
+
+		std::lock_guard<std::mutex> lock(mutex);
+		stats.reads += entry.getEndpointCount();
+		stats.missedDeadlines += missed ? 1 : 0;
+	}
+
+	// Seconds until the next entry is due
+	double getWaitTime(const EntryStore::List& entries, double now) {
+		double next = now + SCHEDULER_MAX_WAIT;
+		for (auto& entry : entries) {
+			if (entry->getEndpointCount() > 0) {
+				next = std::min(next, entry->sampling.refresh ? now : entry->sampling.nextDue);
+			}
+		}
+		return std::max(next - now, 0.0);
+	}
+
+	SchedulerStats getStats() {
+		std::lock_guard<std::mutex> lock(mutex);
+		return stats;
+	}
+
+private:
+	static double getPeriod(const Entry& entry) {
+		return 1.0 / std::max(entry.sampling.rate.load(), ENTRY_MIN_RATE);
+	}
+
+	static double getDeadline(const Entry& entry) {
+		return entry.sampling.nextDue + getPeriod(entry);
+	}
+
+	SchedulerStats stats;
+	std::mutex mutex;
+};
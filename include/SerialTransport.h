@@ -0,0 +1,281 @@
+#pragma once
+
+#include "pch.h"
+#include "CRC.h"
+#include "Transport.h"
+
+#include <condition_variable>
+
+#define STREAM_SYNC_BYTE 0xAA
+#define STREAM_HEADER_SIZE 3				// Sync byte, payload length, CRC8 of both
+#define STREAM_TRAILER_SIZE 2				// CRC16 of the payload, MSB first
+#define STREAM_MAX_PAYLOAD_SIZE 127			// The MSB of the length byte is reserved
+#define STREAM_MAX_PACKET_SIZE (STREAM_HEADER_SIZE + STREAM_MAX_PAYLOAD_SIZE + STREAM_TRAILER_SIZE)
+
+#define SERIAL_DEFAULT_BAUDRATE 115200
+#define SERIAL_OUT_QUEUE_SIZE 64			// Number of frames that can be queued for sending
+#define SERIAL_READ_TIMEOUT 0.1				// Seconds, only used to notice when the transport is stopped
+
+// Packet framing of the ODrive native stream protocol, used wherever there is a byte stream instead of
+// a packet based link: [0xAA] [length] [CRC8] [payload ...] [CRC16 MSB] [CRC16 LSB]
+class StreamFramer {
+public:
+
+	// Frame one packet into 'out', which must hold at least STREAM_MAX_PACKET_SIZE bytes. Returns the number of bytes written.
+	static size_t encode(const uint8_t* payload, size_t length, uint8_t* out) {
+		if (length > STREAM_MAX_PAYLOAD_SIZE)
+			return 0;
+
+		out[0] = STREAM_SYNC_BYTE;
+		out[1] = (uint8_t)length;
+		out[2] = CRC8(out, 2);
+		memcpy(out + STREAM_HEADER_SIZE, payload, length);
+
+		uint16_t crc = CRC16(out + STREAM_HEADER_SIZE, length);
+		out[STREAM_HEADER_SIZE + length] = (uint8_t)(crc >> 8);
+		out[STREAM_HEADER_SIZE + length + 1] = (uint8_t)(crc);
+		return STREAM_HEADER_SIZE + length + STREAM_TRAILER_SIZE;
+	}
+
+	// Feed received bytes, 'onPacket' is called with the payload of every valid packet. After a bad header or
+	// trailer the buffered bytes are scanned again from the byte after the broken sync byte, so a packet that
+	// starts inside the corrupted one is not lost.
+	template<typename F>
+	void feed(const uint8_t* data, size_t length, F&& onPacket) {
+		while (length > 0) {
+			size_t count = std::min(length, buffer.size() - size);
+			memcpy(buffer.data() + size, data, count);
+			size += count;
+			data += count;
+			length -= count;
+			process(onPacket);
+		}
+	}
+
+	uint64_t getErrorCount() const {
+		return errorCount;
+	}
+
+private:
+	template<typename F>
+	void process(F& onPacket) {
+		while (size > 0) {
+			if (buffer[0] != STREAM_SYNC_BYTE) {		// Skip noise up to the next sync byte
+				auto sync = std::find(buffer.begin() + 1, buffer.begin() + size, STREAM_SYNC_BYTE);
+				drop(sync - buffer.begin());
+				continue;
+			}
+
+			if (size < STREAM_HEADER_SIZE)
+				return;
+
+			if (buffer[1] > STREAM_MAX_PAYLOAD_SIZE || CRC8(buffer.data(), 2) != buffer[2]) {
+				resync();
+				continue;
+			}
+
+			size_t payloadSize = buffer[1];
+			size_t packetSize = STREAM_HEADER_SIZE + payloadSize + STREAM_TRAILER_SIZE;
+			if (size < packetSize)
+				return;
+
+			uint16_t crc = buffer[STREAM_HEADER_SIZE + payloadSize] << 8 | buffer[STREAM_HEADER_SIZE + payloadSize + 1];
+			if (CRC16(buffer.data() + STREAM_HEADER_SIZE, payloadSize) != crc) {
+				resync();
+				continue;
+			}
+
+			onPacket(buffer.data() + STREAM_HEADER_SIZE, payloadSize);
+			drop(packetSize);
+		}
+	}
+
+	void resync() {
+		errorCount++;
+		drop(1);
+	}
+
+	void drop(size_t count) {
+		memmove(buffer.data(), buffer.data() + count, size - count);
+		size -= count;
+	}
+
+	std::array<uint8_t, STREAM_MAX_PACKET_SIZE> buffer;
+	size_t size = 0;
+	uint64_t errorCount = 0;
+};
+
+// Transport over a UART or any other serial port, e.g. "COM3" or "/dev/ttyACM0". Works on a pseudo-terminal as well.
+// Requests are framed with the stream protocol and written back to back by the OUT thread, so several of them
+// can be on the wire at once. The IN thread deframes the incoming bytes and hands every packet to the receive callback.
+class SerialTransport : public Transport {
+public:
+
+	SerialTransport(const std::string& port, uint32_t baudrate = SERIAL_DEFAULT_BAUDRATE) : port(port) {
+		if (!openPort(baudrate)) {
+			throw std::runtime_error("Cannot open serial port " + port);
+		}
+	}
+
+	~SerialTransport() {
+		close();
+	}
+
+	void start(ReceiveCallback onReceive, ErrorCallback onError) override {
+		this->onReceive = onReceive;
+		this->onError = onError;
+		inThread = std::thread(&SerialTransport::inLoop, this);
+		outThread = std::thread(&SerialTransport::outLoop, this);
+	}
+
+	// Only waits if the queue is full
+	bool sendFrame(const uint8_t* data, size_t length) override {
+		if (length > STREAM_MAX_PAYLOAD_SIZE)
+			return false;
+
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			condition.wait(lock, [&] { return stopped || queued < SERIAL_OUT_QUEUE_SIZE; });
+			if (stopped)
+				return false;
+
+			Frame& frame = queue[(head + queued) % SERIAL_OUT_QUEUE_SIZE];
+			frame.length = StreamFramer::encode(data, length, frame.data);
+			queued++;
+		}
+		condition.notify_all();
+		return true;
+	}
+
+	void stop() override {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopped = true;
+		}
+		condition.notify_all();
+	}
+
+	void close() override {
+		stop();
+		if (outThread.joinable()) {
+			outThread.join();
+		}
+		if (inThread.joinable()) {
+			inThread.join();		// Returns within one read timeout
+		}
+		if (!closed.exchange(true)) {
+			closePort();
+		}
+	}
+
+	TransportStats getStats() override {
+		TransportStats stats;
+		stats.framesSent = framesSent;
+		stats.framesReceived = framesReceived;
+		stats.bytesSent = bytesSent;
+		stats.bytesReceived = bytesReceived;
+		stats.errors = errors;
+		return stats;
+	}
+
+private:
+	struct Frame {
+		uint8_t data[STREAM_MAX_PACKET_SIZE];
+		size_t length = 0;
+	};
+
+	void inLoop() {
+		StreamFramer deframer;
+		std::array<uint8_t, 256> data;
+		while (!stopped) {
+			int count = readPort(data.data(), data.size());
+			if (stopped)
+				break;
+
+			if (count < 0) {
+				errors++;
+				fail();
+				break;
+			}
+
+			uint64_t framingErrors = deframer.getErrorCount();
+			bytesReceived += count;
+			deframer.feed(data.data(), count, [&](const uint8_t* packet, size_t length) {
+				framesReceived++;
+				onReceive(packet, length);
+			});
+			if (deframer.getErrorCount() != framingErrors) {
+				errors += deframer.getErrorCount() - framingErrors;
+				LOG_TRACE("Serial port {}: Corrupted packet, resynchronizing", port);
+			}
+		}
+	}
+
+	// Everything that is queued goes out in one write
+	void outLoop() {
+		std::array<uint8_t, STREAM_MAX_PACKET_SIZE * SERIAL_OUT_QUEUE_SIZE> data;
+		while (true) {
+			size_t length = 0;
+			size_t frames = 0;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				condition.wait(lock, [&] { return stopped || queued > 0; });
+				if (stopped)
+					break;
+
+				for (; queued > 0; queued--, frames++) {
+					memcpy(data.data() + length, queue[head].data, queue[head].length);
+					length += queue[head].length;
+					head = (head + 1) % SERIAL_OUT_QUEUE_SIZE;
+				}
+			}
+			condition.notify_all();
+
+			if (!writePort(data.data(), length)) {
+				errors++;
+				fail();
+				break;
+			}
+			framesSent += frames;
+			bytesSent += length;
+		}
+	}
+
+	void fail() {
+		stop();
+		if (onError) {
+			onError();
+		}
+	}
+
+	// Platform specific, see SerialTransport.cpp
+	bool openPort(uint32_t baudrate);
+	void closePort();
+	int readPort(uint8_t* data, size_t length);		// Returns 0 on timeout and -1 on error or hangup
+	bool writePort(const uint8_t* data, size_t length);
+
+	std::string port;
+	intptr_t handle = -1;
+	intptr_t readEvent = 0;			// Windows only, for the overlapped reads and writes
+	intptr_t writeEvent = 0;
+
+	ReceiveCallback onReceive;
+	ErrorCallback onError;
+
+	std::array<Frame, SERIAL_OUT_QUEUE_SIZE> queue;
+	size_t head = 0;
+	size_t queued = 0;
+
+	std::atomic<uint64_t> framesSent = 0;
+	std::atomic<uint64_t> framesReceived = 0;
+	std::atomic<uint64_t> bytesSent = 0;
+	std::atomic<uint64_t> bytesReceived = 0;
+	std::atomic<uint64_t> errors = 0;
+
+	std::atomic<bool> stopped = false;
+	std::atomic<bool> closed = false;
+	std::mutex mutex;
+	std::condition_variable condition;
+	std::thread inThread;
+	std::thread outThread;
+};
@@ -0,0 +1,186 @@
+#pragma once
+
+#include "pch.h"
+#include "CRC.h"
+#include "Endpoint.h"
+#include "LoopbackTransport.h"
+
+#include "json.hpp"
+
+// Software model of an ODrive speaking the native protocol, to be plugged into a LoopbackTransport.
+// It serves the JSON definition and keeps a value for every endpoint in it, so the whole protocol stack,
+// the descriptor loader and the polling loops can run without hardware.
+class SoftwareODrive : public DeviceModel {
+public:
+
+	SoftwareODrive(const std::string& json, uint64_t serialNumber) : json(json) {
+		jsonCRC = CRC16_JSON((uint8_t*)this->json.data(), this->json.length());
+		for (auto& node : nlohmann::json::parse(json)) {
+			addNode(node, "");
+		}
+		setValue<uint64_t>("serial_number", serialNumber);
+		setValue<uint8_t>("fw_version_minor", 5);
+		setValue<uint8_t>("fw_version_revision", 4);
+		setValue<float>("vbus_voltage", 24.f);
+	}
+
+	int handleFrame(const uint8_t* frame, size_t length, uint8_t* response, size_t maxResponseLength) override {
+
+		if (length < 8 || maxResponseLength < 2)
+			return -1;
+
+		uint16_t sequence = frame[0] | frame[1] << 8;
+		uint16_t endpoint = frame[2] | frame[3] << 8;
+		uint16_t expectedResponseSize = frame[4] | frame[5] << 8;
+		uint16_t trailer = frame[length - 2] | frame[length - 1] << 8;
+		const uint8_t* payload = frame + 6;
+		size_t payloadSize = length - 8;
+
+		bool ack = endpoint & 0x8000;
+		uint16_t id = endpoint & 0x7FFF;
+		size_t responseSize = std::min<size_t>(expectedResponseSize, maxResponseLength - 2);
+
+		std::lock_guard<std::mutex> lock(mutex);
+
+		if (id == 0) {		// The JSON definition, read in chunks
+			if (trailer != 1 || payloadSize != sizeof(uint32_t))
+				return -1;
+
+			uint32_t offset = 0;
+			memcpy(&offset, payload, sizeof(offset));
+			responseSize = (offset < json.length()) ? std::min<size_t>(responseSize, json.length() - offset) : 0;
+			memcpy(response + 2, json.data() + std::min<size_t>(offset, json.length()), responseSize);
+		}
+		else {
+			if (trailer != jsonCRC)		// Requests for a different firmware are silently dropped, just like on the real device
+				return -1;
+
+			auto it = values.find(id);
+			if (it == values.end())
+				return -1;
+
+			Value& value = it->second;
+			if (payloadSize > 0 && !value.function) {
+				memcpy(&value.data, payload, std::min<size_t>(payloadSize, value.size));
+			}
+			responseSize = std::min<size_t>(responseSize, value.size);
+			memcpy(response + 2, &value.data, responseSize);
+		}
+
+		if (!ack)
+			return -1;
+
+		response[0] = (uint8_t)(sequence);
+		response[1] = (uint8_t)((sequence | 0x8000) >> 8);
+		return (int)(responseSize + 2);
+	}
+
+	template<typename T>
+	void setValue(const std::string& identifier, T value) {
+		std::lock_guard<std::mutex> lock(mutex);
+		for (auto& [id, v] : values) {
+			if (v.identifier == identifier) {
+				v.data = 0;
+				memcpy(&v.data, &value, std::min(sizeof(T), v.size));
+			}
+		}
+	}
+
+	// A small firmware definition with the endpoints the GUI uses, for running without a descriptor file
+	static std::string defaultDescriptor() {
+		uint16_t id = 1;
+		auto property = [&](const std::string& name, const std::string& type, const std::string& access = "r") {
+			return nlohmann::json{ { "name", name }, { "id", id++ }, { "type", type }, { "access", access } };
+		};
+		auto function = [&](const std::string& name) {
+			return nlohmann::json{ { "name", name }, { "id", id++ }, { "type", "function" },
+				{ "inputs", nlohmann::json::array() }, { "outputs", nlohmann::json::array() } };
+		};
+		auto object = [](const std::string& name, nlohmann::json members) {
+			return nlohmann::json{ { "name", name }, { "type", "object" }, { "members", members } };
+		};
+		auto axis = [&](const std::string& name) {
+			return object(name, {
+				property("error", "uint32", "rw"),
+				property("current_state", "uint8"),
+				property("requested_state", "uint8", "rw"),
+				object("motor", {
+					property("error", "uint32", "rw"),
+					object("current_control", { property("Iq_setpoint", "float"), property("Iq_measured", "float") }),
+					object("fet_thermistor", { property("temperature", "float") }),
+					object("config", { property("motor_type", "uint8", "rw"), property("current_lim", "float", "rw") })
+				}),
+				object("encoder", {
+					property("error", "uint32", "rw"),
+					property("pos_estimate", "float"),
+					property("vel_estimate", "float"),
+					object("config", { property("mode", "uint16", "rw"), property("cpr", "int32", "rw") })
+				}),
+				object("controller", {
+					property("error", "uint8", "rw"),
+					property("input_pos", "float", "rw"),
+					property("input_vel", "float", "rw"),
+					object("config", { property("control_mode", "uint8", "rw"), property("input_mode", "uint8", "rw") })
+				}),
+				function("clear_errors")
+			});
+		};
+
+		nlohmann::json root = nlohmann::json::array({
+			{ { "name", "" }, { "id", 0 }, { "type", "json" }, { "access", "r" } },
+			property("vbus_voltage", "float"),
+			property("ibus", "float"),
+			property("serial_number", "uint64"),
+			property("hw_version_major", "uint8"),
+			property("fw_version_major", "uint8"),
+			property("fw_version_minor", "uint8"),
+			property("fw_version_revision", "uint8"),
+			property("fw_version_unreleased", "uint8"),
+			property("user_config_loaded", "bool"),
+			axis("axis0"),
+			axis("axis1"),
+			function("save_configuration"),
+			function("reboot")
+		});
+		return root.dump();
+	}
+
+private:
+	struct Value {
+		std::string identifier;
+		size_t size = 0;
+		uint64_t data = 0;
+		bool function = false;
+	};
+
+	void addNode(const nlohmann::json& node, const std::string& parentPath) {
+		std::string type = node["type"];
+		std::string identifier = ((parentPath.size() > 0) ? (parentPath + ".") : ("")) + std::string(node["name"]);
+
+		if (type == "json") {
+			return;
+		}
+		else if (type == "object") {
+			for (auto& member : node["members"]) {
+				addNode(member, identifier);
+			}
+		}
+		else if (type == "function") {
+			values[node["id"]] = { identifier, 1, 0, true };
+			for (auto& input : node["inputs"]) {
+				addNode(input, identifier);
+			}
+			for (auto& output : node["outputs"]) {
+				addNode(output, identifier);
+			}
+		}
+		else {
+			values[node["id"]] = { identifier, EndpointValue(type).size(), 0, false };
+		}
+	}
+
+	std::string json;
+	uint16_t jsonCRC = 0;
+	std::map<uint16_t, Value> values;
+	std::mutex mutex;
+};
@@ -20,6 +20,8 @@ class StatusBar : public Battery::ImGuiPanel<> {
 
 	float windowWidth = 0.f;
 	float windowHeight = 0.f;
+	float scrollX = 0.f;
+	float vbusVoltage = 0.f;
 
 public:
 	FontContainer* fonts = nullptr;
@@ -37,41 +39,51 @@ public:
 		windowHeight = Battery::GetMainWindow().GetSize().y;
 	}
 
+	// One field per device side by side, the bar scrolls horizontally when there are more than fit.
+	// Only the visible ones are drawn, so the cost does not grow with the number of devices.
 	void makeODriveClickableFields() {
 
-		ImGui::Columns(4);
-
-		for (int i = 0; i < MAX_NUMBER_OF_ODRIVES; i++) {
-			ImGui::SetColumnWidth(i, STATUS_BAR_ELEMENTS_WIDTH);
-			auto& odrive = backend->odrives[i];
-			if (odrive) {
-
-				ImGui::SetCursorPosY(0);
-				openODriveInfo = ImGui::Selectable(("##Selectable" + std::to_string(i)).c_str(), false, 0, ImVec2(size.x / 4.f - 15, 45));
-				if (openODriveInfo) {
-					odriveSelected = i;
-				}
+		auto odrives = backend->odrives.getAll();
+		scrollX = ImGui::GetScrollX();
+		int first = (int)(scrollX / STATUS_BAR_ELEMENTS_WIDTH);
+		int last = std::min((int)((scrollX + windowWidth) / STATUS_BAR_ELEMENTS_WIDTH), (int)odrives->size() - 1);
+
+		for (int i = std::max(first, 0); i <= last; i++) {
+			auto& odrive = (*odrives)[i];
+			if (!odrive)
+				continue;
+
+			float x = (float)STATUS_BAR_ELEMENTS_WIDTH * i;
+			ImGui::SetCursorPos({ x, 0 });
+			if (ImGui::Selectable(("##Selectable" + std::to_string(i)).c_str(), false, 0, ImVec2(STATUS_BAR_ELEMENTS_WIDTH - 15, 45))) {
+				openODriveInfo = true;
+				odriveSelected = i;
+				vbusVoltage = 0.f;		// Until the first reading of this one arrived
+			}
 
-				ImGui::SetCursorPosX(ImGui::GetCursorPosX() + 50);
-				ImGui::SetCursorPosY(8.5);
+			ImGui::SetCursorPos({ x + 50, 8.5f });
 
-				if (backend->odrives[i]->error) {
-					ImGui::TextColored(RED, "odrv%d", i);
-				}
-				else {
-					ImGui::Text("odrv%d", i);
-				}
-				ImGui::SameLine();
-				if (backend->odrives[i]->connected) {
-					ImGui::TextColored(GREEN, "[Connected]");
-				}
-				else {
-					ImGui::TextColored(RED, "[Disconnected]");
-				}
+			if (odrive->error) {
+				ImGui::TextColored(RED, "odrv%d", i);
+			}
+			else {
+				ImGui::Text("odrv%d", i);
+			}
+			ImGui::SameLine();
+			if (odrive->connected && !odrive->isResponding()) {
+				ImGui::TextColored(YELLOW, "[Not responding]");
+			}
+			else if (odrive->connected) {
+				ImGui::TextColored(GREEN, "[Connected]");
+			}
+			else {
+				ImGui::TextColored(RED, "[Disconnected]");
 			}
-
-			ImGui::NextColumn();
 		}
+
+		// Reserve the width of all fields, so the scrollbar covers every device
+		ImGui::SetCursorPos({ (float)STATUS_BAR_ELEMENTS_WIDTH * odrives->size(), 0 });
+		ImGui::Dummy({ 0, 0 });
 	}
 
 	template<typename T>
@@ -107,16 +119,18 @@ public:
 		}
 		
 		// Handle the odrive info popup
-		ImGui::SetNextWindowPos({ (float)STATUS_BAR_ELEMENTS_WIDTH * odriveSelected, windowHeight - STATUS_BAR_HEIGHT - ODRIVE_POPUP_HEIGHT });
+		ImGui::SetNextWindowPos({ (float)STATUS_BAR_ELEMENTS_WIDTH * odriveSelected - scrollX, windowHeight - STATUS_BAR_HEIGHT - ODRIVE_POPUP_HEIGHT });
 		ImGui::SetNextWindowSize({ STATUS_BAR_ELEMENTS_WIDTH, ODRIVE_POPUP_HEIGHT });
 		ImGui::PushStyleVar(ImGuiStyleVar_WindowPadding, { 12, 12 });
-		if (ImGui::BeginPopupContextWindow("ODriveInfo")) {
-			auto odrive = backend->odrives[std::clamp(odriveSelected, 0, 3)];
-
-			static float vbus_voltage = 0.f;
+		auto odrive = backend->odrives.get(odriveSelected);
+		if (odrive && ImGui::BeginPopupContextWindow("ODriveInfo")) {
 
 			if (Battery::GetApp().framecount % 10 == 0) {
-				odrive->read<float>("vbus_voltage", &vbus_voltage);
+				backend->post(odriveSelected, "vbus", [](ODrive& o) { float v = NAN; o.readVbusVoltage(&v); return v; }, [this, id = odriveSelected](float v) {
+					if (id == odriveSelected && !std::isnan(v)) {
+						vbusVoltage = v;
+					}
+				});
 			}
 
 
@@ -124,7 +138,28 @@ public:
 
 			ImGui::Text("Voltage: ");
 			ImGui::SameLine();
-			ImGui::TextColored(GREEN, "%.03f V", vbus_voltage);
+			ImGui::TextColored(GREEN, "%.03f V", vbusVoltage);
+
+			// Responses that did not belong to a waiting request hint at a flaky link
+			DemultiplexerStats stats = odrive->getResponseStats();
+			uint64_t stray = stats.stale + stats.duplicate + stats.unmatched;
+			ImGui::BeginGroup();
+			ImGui::Text("Round trip: ");
+			ImGui::SameLine();
+			ImGui::TextColored(LIGHT_BLUE, "%.02f ms", stats.roundTripTime * 1000.0);
+			if (stray > 0) {
+				ImGui::SameLine();
+				ImGui::TextColored(YELLOW, " (%llu stray)", (unsigned long long)stray);
+			}
+			ImGui::EndGroup();
+			if (ImGui::IsItemHovered()) {
+				ImGui::BeginTooltip();
+				ImGui::Text("%llu responses matched", (unsigned long long)stats.matched);
+				ImGui::Text("%llu stale, arrived after their request timed out", (unsigned long long)stats.stale);
+				ImGui::Text("%llu duplicate", (unsigned long long)stats.duplicate);
+				ImGui::Text("%llu unmatched", (unsigned long long)stats.unmatched);
+				ImGui::EndTooltip();
+			}
 
 			ImGui::PushStyleVar(ImGuiStyleVar_ItemSpacing, { 0, 20 });
 
@@ -225,7 +260,7 @@ public:
 				}
 
 				if (ImGui::Button("Export endpoint definitions", { -1, 40 })) {
-					odrive->exportEndpoints();
+					backend->exportEndpoints(odriveSelected);
 				}
 
 				ImGui::PopStyleVar();
@@ -237,15 +272,15 @@ public:
 	}
 
 	template<typename T>
-	void drawEndpointValue(ImVec4 color, Endpoint& ep, const char* fmt) {
+	void drawEndpointValue(ImVec4 color, const BasicEndpoint& ep, const char* fmt) {
 
-		EndpointValue& v = backend->getCachedEndpointValue(ep->fullPath);
+		EndpointValue& v = backend->getCachedEndpointValue(ep.fullPath);
 		T value = 0;
 		if (v.type() != EndpointValueType::INVALID) {
 			value = v.get<T>();
 		}
 
-		const std::string& enumName = EndpointValueToEnumName(ep.basic, (int32_t)value, v.type());
+		const std::string& enumName = EndpointValueToEnumName(ep, (int32_t)value, v.type());
 		if (enumName.length() > 0) {
 			ImGui::TextColored(color, "%s", enumName.c_str());
 		}
@@ -256,7 +291,7 @@ public:
 		if (ImGui::IsItemHovered()) {
 			ImGui::PushFont(fonts->openSans21);
 			ImGui::BeginTooltip();
-			ImGui::TextColored(color, "%s", ep->type.c_str());
+			ImGui::TextColored(color, "%s", getEndpointTypeName(ep.type));
 
 			if (enumName.length() > 0) {
 				ImGui::SameLine();
@@ -270,93 +305,83 @@ public:
 		}
 	}
 
-	void drawEndpointValueBool(ImVec4 color, Endpoint& ep) {
+	void drawEndpointValueBool(ImVec4 color, const BasicEndpoint& ep) {
 
-		EndpointValue& v = backend->getCachedEndpointValue(ep->fullPath);
+		EndpointValue& v = backend->getCachedEndpointValue(ep.fullPath);
 
 		ImGui::TextColored(color, "%s", v.get<bool>() ? "true" : "false");
 
 		if (ImGui::IsItemHovered()) {
 			ImGui::PushFont(fonts->openSans21);
 			ImGui::BeginTooltip();
-			ImGui::TextColored(color, "%s", ep->type.c_str());
+			ImGui::TextColored(color, "%s", getEndpointTypeName(ep.type));
 			ImGui::EndTooltip();
 			ImGui::PopFont();
 		}
 	}
 	
-	void drawEndpoint(Endpoint& ep, int indent) {
+	// Works on the flat endpoint table, an endpoint is only copied out when its line is actually drawn
+	void drawEndpoint(std::shared_ptr<ODrive>& odrive, uint32_t index, int indent) {
+
+		const EndpointTable& table = *odrive->endpoints;
+		BasicEndpoint ep = table.makeBasicEndpoint(index, odrive->odriveID);
 
 		ImGui::SetCursorPosX(indent);
 
-		if (ep.children.size() > 0) {	// It's a node with children
-			if (ImGui::TreeNode((ep->identifier + "##" + ep->fullPath).c_str())) {
-				for (Endpoint& e : ep.children) {
-					drawEndpoint(e, indent + ENDPOINT_TREE_INDENT);
-				}
+		if (table.getType(index) == EndpointType::OBJECT) {	// It's a node with children
+			if (ImGui::TreeNode((ep.identifier + "##" + ep.fullPath).c_str())) {
+				table.forEachChild(index, [&](uint32_t child) {
+					drawEndpoint(odrive, child, indent + ENDPOINT_TREE_INDENT);
+				});
 				ImGui::TreePop();
 			}
 		}
-		else if (ep->type == "function") {		// It's a function
+		else if (ep.type == EndpointType::FUNCTION) {		// It's a function
 
-			ImGui::BulletText("%s()   ->", ep->identifier.c_str());
+			ImGui::BulletText("%s()   ->", ep.identifier.c_str());
 			ImGui::SameLine();
 			ImGui::TextColored(COLOR_FUNCTION, "function");
 			ImGui::SameLine();
 			ImGui::SetCursorPosX(ImGui::GetWindowWidth() - 70);
-			if (ImGui::Button(("+##" + ep->fullPath).c_str(), { 40, 0 })) {
-				Endpoint e = ep;
-				e.children.clear();
-				backend->addEntry(Entry(e));
+			if (ImGui::Button(("+##" + ep.fullPath).c_str(), { 40, 0 })) {
+				backend->addEntry(Entry(table.makeEndpoint(index, odrive->odriveID)));
 			}
 		}
 		else {			// It's a numeric endpoint with a value
 
-			ImGui::BulletText("%s   = ", ep->identifier.c_str());
+			ImGui::BulletText("%s   = ", ep.identifier.c_str());
 			ImGui::SameLine();
 
-			if (ep->type == "float") {
-				drawEndpointValue<float>(COLOR_FLOAT, ep, "%.03ff");
-			}
-			else if (ep->type == "uint8") {
-				drawEndpointValue<uint8_t>(COLOR_UINT, ep, "%d");
-			}
-			else if (ep->type == "uint16") {
-				drawEndpointValue<uint16_t>(COLOR_UINT, ep, "%d");
-			}
-			else if (ep->type == "uint32") {
-				drawEndpointValue<uint32_t>(COLOR_UINT, ep, "%d");
-			}
-			else if (ep->type == "uint64") {
-				drawEndpointValue<uint64_t>(COLOR_UINT, ep, "%d");
-			}
-			else if (ep->type == "int32") {
-				drawEndpointValue<uint32_t>(COLOR_UINT, ep, "%d");
-			}
-			else if (ep->type == "bool") {
-				drawEndpointValueBool(COLOR_BOOL, ep);
+			switch (ep.type) {
+			case EndpointType::FLOAT:	drawEndpointValue<float>(COLOR_FLOAT, ep, "%.03ff"); break;
+			case EndpointType::UINT8:	drawEndpointValue<uint8_t>(COLOR_UINT, ep, "%d"); break;
+			case EndpointType::UINT16:	drawEndpointValue<uint16_t>(COLOR_UINT, ep, "%d"); break;
+			case EndpointType::UINT32:	drawEndpointValue<uint32_t>(COLOR_UINT, ep, "%d"); break;
+			case EndpointType::UINT64:	drawEndpointValue<uint64_t>(COLOR_UINT, ep, "%d"); break;
+			case EndpointType::INT32:	drawEndpointValue<uint32_t>(COLOR_UINT, ep, "%d"); break;
+			case EndpointType::BOOL:	drawEndpointValueBool(COLOR_BOOL, ep); break;
+			default: break;
 			}
 
 			ImGui::SameLine();
 			ImGui::Text("                ");
 			ImGui::SameLine();
 			ImGui::SetCursorPosX(ImGui::GetWindowWidth() - 70);
-			if (ImGui::Button(("+##" + ep->fullPath).c_str(), { 40, 0 })) {
-				Endpoint e = ep;
-				e.children.clear();
-				backend->addEntry(Entry(e));
+			if (ImGui::Button(("+##" + ep.fullPath).c_str(), { 40, 0 })) {
+				backend->addEntry(Entry(table.makeEndpoint(index, odrive->odriveID)));
 			}
 		}
 	}
 
 	void drawEndpointList() {
 
-		if (!backend->odrives[odriveSelected])
+		auto odrive = backend->odrives.get(odriveSelected);
+		if (!odrive)
 			return;
 
-		for (Endpoint& ep : backend->odrives[odriveSelected]->endpoints) {
-			drawEndpoint(ep, ImGui::GetCursorPosX());
-		}
+		odrive->endpoints->forEachChild(ENDPOINT_NONE, [&](uint32_t index) {
+			drawEndpoint(odrive, index, ImGui::GetCursorPosX());
+		});
 	}
 
 	void drawEndpointSelectorWindow() {
@@ -371,8 +396,6 @@ public:
 		ImGui::SetNextWindowPos({ 0, 0 });
 		ImGui::SetNextWindowSizeConstraints({ ENDPOINT_SELECTOR_WIDTH, -1 }, { windowWidth, -1 });
 		if (ImGui::BeginPopupContextWindow("EndpointSelector")) {
-			auto odrive = backend->odrives[std::clamp(odriveSelected, 0, 3)];
-
 			ImGui::PushStyleVar(ImGuiStyleVar_ItemSpacing, { 0, 15 });
 			ImGui::Text("Endpoints of odrv%d:", odriveSelected);
 			ImGui::Separator();
@@ -0,0 +1,140 @@
+#pragma once
+
+#include "pch.h"
+#include "Endpoint.h"
+
+#define TIME_SERIES_DEFAULT_CAPACITY 16384		// Samples per endpoint, rounded up to a power of two. 16 s at 1 kHz.
+
+// The history of one endpoint: A ring of (timestamp, value) pairs with one writer, the poller, and any number of
+// readers that never take a lock and never stall the writer. Timestamps and values are kept in two contiguous
+// arrays, the values in the native type of the endpoint.
+//
+// Every sample has an index that only grows. The writer claims an index before it touches the slot and publishes
+// the sample afterwards by advancing the head. Readers check the claimed index after reading, like a seqlock:
+// Whatever the writer may have overwritten meanwhile is dropped.
+class TimeSeries {
+public:
+	virtual ~TimeSeries() = default;
+
+	virtual EndpointValueType getType() const = 0;
+
+	// Writer only, values of another type are converted
+	virtual void push(double time, const EndpointValue& value) = 0;
+
+	// Copy the samples from index 'from' on into the given arrays, oldest first, converted to double for consumers
+	// that do not care about the type. 'from' is moved past the last sample returned, so calling this again only
+	// returns new samples. Samples that are already overwritten are skipped. Returns the number of samples copied.
+	virtual size_t copy(uint64_t& from, double* times, double* values, size_t maxCount) const = 0;
+
+	// Index of the next sample to be written, i.e. the number of samples written so far
+	uint64_t getHead() const {
+		return head.load(std::memory_order_acquire);
+	}
+
+	// Index of the oldest sample that is still kept
+	uint64_t getTail() const {
+		uint64_t h = getHead();
+		return (h > capacity) ? h - capacity : 0;
+	}
+
+	size_t getCapacity() const {
+		return capacity;
+	}
+
+protected:
+	TimeSeries(size_t capacity) : capacity(roundUpToPowerOfTwo(capacity)), mask(this->capacity - 1) {
+	}
+
+	static size_t roundUpToPowerOfTwo(size_t n) {
+		size_t p = 1;
+		while (p < n) p <<= 1;
+		return p;
+	}
+
+	// Writer only: Announce the next sample before its slot is overwritten
+	uint64_t claim() {
+		uint64_t index = head.load(std::memory_order_relaxed);
+		claimed.store(index + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		return index;
+	}
+
+	void publish(uint64_t index) {
+		head.store(index + 1, std::memory_order_release);
+	}
+
+	// Reader only, after reading the slots: Samples from this index on were not overwritten meanwhile
+	uint64_t getFirstIntact() const {
+		std::atomic_thread_fence(std::memory_order_acquire);
+		uint64_t c = claimed.load(std::memory_order_relaxed);
+		return (c > capacity) ? c - capacity : 0;
+	}
+
+	const size_t capacity;
+	const size_t mask;
+	std::atomic<uint64_t> claimed = 0;		// Index + 1 of the sample being written, ahead of head while a push runs
+	std::atomic<uint64_t> head = 0;
+};
+
+template<typename T>
+class TypedTimeSeries : public TimeSeries {
+public:
+
+	TypedTimeSeries(size_t capacity = TIME_SERIES_DEFAULT_CAPACITY) : TimeSeries(capacity),
+		times(new std::atomic<double>[this->capacity]), values(new std::atomic<T>[this->capacity]) {
+	}
+
+	EndpointValueType getType() const override {
+		return EndpointValue(T()).type();
+	}
+
+	void push(double time, const EndpointValue& value) override {
+		push(time, value.get<T>());
+	}
+
+	void push(double time, T value) {
+		uint64_t index = claim();
+		size_t slot = index & mask;
+		times[slot].store(time, std::memory_order_relaxed);		// Atomic only so a concurrent read is no data race,
+		values[slot].store(value, std::memory_order_relaxed);	// on x86 these are plain moves
+		publish(index);
+	}
+
+	size_t copy(uint64_t& from, double* outTimes, double* outValues, size_t maxCount) const override {
+		uint64_t start = std::max(from, getTail());
+		uint64_t end = std::min(getHead(), start + maxCount);
+		for (uint64_t i = start; i < end; i++) {
+			outTimes[i - start] = times[i & mask].load(std::memory_order_relaxed);
+			outValues[i - start] = (double)values[i & mask].load(std::memory_order_relaxed);
+		}
+
+		// Drop whatever was overwritten while copying, it is at the front
+		uint64_t valid = std::max(start, getFirstIntact());
+		size_t skipped = (size_t)(std::min(valid, end) - start);
+		if (skipped > 0 && end > start) {
+			std::move(outTimes + skipped, outTimes + (end - start), outTimes);
+			std::move(outValues + skipped, outValues + (end - start), outValues);
+		}
+
+		from = end;
+		return (size_t)(end - start) - skipped;
+	}
+
+private:
+	std::unique_ptr<std::atomic<double>[]> times;
+	std::unique_ptr<std::atomic<T>[]> values;
+};
+
+// nullptr for types without a value, like functions
+static inline std::shared_ptr<TimeSeries> makeTimeSeries(EndpointValueType type, size_t capacity = TIME_SERIES_DEFAULT_CAPACITY) {
+	switch (type) {
+	case EndpointValueType::BOOL:	return std::make_shared<TypedTimeSeries<bool>>(capacity);
+	case EndpointValueType::FLOAT:	return std::make_shared<TypedTimeSeries<float>>(capacity);
+	case EndpointValueType::UINT8:	return std::make_shared<TypedTimeSeries<uint8_t>>(capacity);
+	case EndpointValueType::UINT16:	return std::make_shared<TypedTimeSeries<uint16_t>>(capacity);
+	case EndpointValueType::UINT32:	return std::make_shared<TypedTimeSeries<uint32_t>>(capacity);
+	case EndpointValueType::UINT64:	return std::make_shared<TypedTimeSeries<uint64_t>>(capacity);
+	case EndpointValueType::INT32:	return std::make_shared<TypedTimeSeries<int32_t>>(capacity);
+	default:						return nullptr;
+	}
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "pch.h"
+
+struct TransportStats {
+	uint64_t framesSent = 0;
+	uint64_t framesReceived = 0;
+	uint64_t bytesSent = 0;
+	uint64_t bytesReceived = 0;
+	uint64_t errors = 0;
+};
+
+// Moves native protocol frames between an ODrive object and the device behind it
+class Transport {
+public:
+	using ReceiveCallback = std::function<void(const uint8_t* data, size_t length)>;
+	using ErrorCallback = std::function<void()>;
+
+	virtual ~Transport() = default;
+
+	// Start delivering received frames, the callbacks are called from a transport thread
+	virtual void start(ReceiveCallback onReceive, ErrorCallback onError) = 0;
+
+	// Queue a frame for sending, returns false if the transport was stopped
+	virtual bool sendFrame(const uint8_t* data, size_t length) = 0;
+
+	// Stop all transfers without waiting, safe to call from a callback
+	virtual void stop() = 0;
+
+	// Stop and release the device, waits for the transport threads
+	virtual void close() = 0;
+
+	virtual TransportStats getStats() = 0;
+};
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "pch.h"
+
+#include <condition_variable>
+
+#define USB_HOTPLUG_RESCAN_INTERVAL 10.0f	// Seconds, a full scan now and then even when hotplug events are available
+#define USB_HOTPLUG_SETTLE_TIME 0.1f		// Seconds between an arrival and the scan, so the device can be opened
+
+// Tells the USB listener when a device with the given IDs is plugged in, through libusb hotplug events.
+// Where libusb has no hotplug support (e.g. on Windows) isSupported() is false and the listener keeps scanning.
+class UsbHotplug {
+public:
+
+	UsbHotplug(uint16_t vendorID, uint16_t productID);
+	~UsbHotplug();
+
+	bool isSupported() const {
+		return supported;
+	}
+
+	// Block until a device arrived, the timeout passed or wake() was called. Returns true if a device arrived.
+	bool waitForArrival(double timeout) {
+		std::unique_lock<std::mutex> lock(mutex);
+		condition.wait_for(lock, std::chrono::duration<double>(timeout), [&] { return arrived || woken; });
+		bool result = arrived;
+		arrived = false;
+		woken = false;
+		return result;
+	}
+
+	void wake() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			woken = true;
+		}
+		condition.notify_all();
+	}
+
+private:
+	void onArrival() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			arrived = true;
+		}
+		condition.notify_all();
+	}
+
+	void eventLoop();
+
+	void* context = nullptr;		// libusb_context, not exposed so the header does not need libusb
+	int callbackHandle = 0;
+	bool supported = false;
+
+	bool arrived = false;
+	bool woken = false;
+	std::mutex mutex;
+	std::condition_variable condition;
+
+	std::atomic<bool> stopped = false;
+	std::thread eventThread;
+
+	friend struct UsbHotplugCallback;
+};
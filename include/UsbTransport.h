@@ -0,0 +1,195 @@
+#pragma once
+
+#include "pch.h"
+#include "libusbcpp.h"
+#include "Transport.h"
+
+#include <condition_variable>
+
+#define ODRIVE_VENDOR_ID 0x1209
+#define ODRIVE_PRODUCT_ID 0x0D32
+
+#define ODRIVE_USB_INTERFACE 2
+#define ODRIVE_USB_READ_ENDPOINT (uint16_t)0x83
+#define ODRIVE_USB_WRITE_ENDPOINT (uint16_t)0x03
+
+#define USB_MAX_PACKET_SIZE 64
+#define USB_OUT_QUEUE_SIZE 64			// Number of frames that can be queued for sending
+#define USB_WRITE_RETRIES 5
+#define USB_FAST_FAILURE_TIME 0.01		// An empty read returning quicker than this (in seconds) is an error, not a timeout
+#define USB_MAX_FAST_FAILURES 3
+
+// Transport over the native USB interface of an ODrive. All transfers run on their own service threads,
+// so callers never park inside libusb. The IN endpoint always has a read posted, received packets are
+// handed to the receive callback as they complete. Outgoing frames are queued and written in order by the OUT thread.
+class UsbTransport : public Transport {
+public:
+
+	UsbTransport(libusbcpp::device device) : device(device) {
+		if (!device) {
+			throw std::runtime_error("ODrive device is nullptr!");
+		}
+		if (!device->claimInterface(ODRIVE_USB_INTERFACE)) {
+			throw std::runtime_error("Cannot claim USB interface");
+		}
+	}
+
+	~UsbTransport() {
+		close();
+	}
+
+	void start(ReceiveCallback onReceive, ErrorCallback onError) override {
+		this->onReceive = onReceive;
+		this->onError = onError;
+		inThread = std::thread(&UsbTransport::inLoop, this);
+		outThread = std::thread(&UsbTransport::outLoop, this);
+	}
+
+	// Only waits if the queue is full
+	bool sendFrame(const uint8_t* data, size_t length) override {
+		if (length > USB_MAX_PACKET_SIZE)
+			return false;
+
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			condition.wait(lock, [&] { return stopped || queued < USB_OUT_QUEUE_SIZE; });
+			if (stopped)
+				return false;
+
+			Frame& frame = queue[(head + queued) % USB_OUT_QUEUE_SIZE];
+			memcpy(frame.data, data, length);
+			frame.length = length;
+			queued++;
+		}
+		condition.notify_all();
+		return true;
+	}
+
+	void stop() override {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopped = true;
+		}
+		condition.notify_all();
+	}
+
+	// The IN thread notices the stop flag once its read returns, at the latest after the bulk read timeout.
+	// The device is only closed when no transfer can be in flight anymore.
+	void close() override {
+		stop();
+		if (outThread.joinable()) {
+			outThread.join();
+		}
+		if (inThread.joinable()) {
+			inThread.join();
+		}
+		if (device && !closed.exchange(true)) {
+			device->close();
+		}
+	}
+
+	TransportStats getStats() override {
+		TransportStats stats;
+		stats.framesSent = framesSent;
+		stats.framesReceived = framesReceived;
+		stats.bytesSent = bytesSent;
+		stats.bytesReceived = bytesReceived;
+		stats.errors = errors;
+		return stats;
+	}
+
+private:
+	struct Frame {
+		uint8_t data[USB_MAX_PACKET_SIZE];
+		size_t length = 0;
+	};
+
+	void inLoop() {
+		int fastFailures = 0;
+		while (!stopped) {
+			double start = Runtime::getTime();
+			auto packet = device->bulkRead(USB_MAX_PACKET_SIZE, ODRIVE_USB_READ_ENDPOINT);
+			if (stopped)
+				break;
+
+			if (packet.size() > 0) {
+				fastFailures = 0;
+				framesReceived++;
+				bytesReceived += packet.size();
+				onReceive(packet.data(), packet.size());
+			}
+			else if (Runtime::getTime() - start < USB_FAST_FAILURE_TIME) {
+				errors++;
+				if (++fastFailures >= USB_MAX_FAST_FAILURES) {
+					fail();
+					break;
+				}
+			}
+			else {
+				fastFailures = 0;	// Plain timeout, the device had nothing to say
+			}
+		}
+	}
+
+	void outLoop() {
+		while (true) {
+			Frame frame;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				condition.wait(lock, [&] { return stopped || queued > 0; });
+				if (stopped)
+					break;
+
+				frame = queue[head];
+				head = (head + 1) % USB_OUT_QUEUE_SIZE;
+				queued--;
+			}
+			condition.notify_all();
+
+			bool written = false;
+			for (int i = 0; i < USB_WRITE_RETRIES && !written; i++) {
+				written = (device->bulkWrite(frame.data, frame.length, ODRIVE_USB_WRITE_ENDPOINT) != -1);
+				if (!written) {
+					errors++;
+				}
+			}
+			if (written) {
+				framesSent++;
+				bytesSent += frame.length;
+			}
+			else {
+				fail();
+				break;
+			}
+		}
+	}
+
+	void fail() {
+		stop();
+		if (onError) {
+			onError();
+		}
+	}
+
+	libusbcpp::device device;
+
+	ReceiveCallback onReceive;
+	ErrorCallback onError;
+
+	std::array<Frame, USB_OUT_QUEUE_SIZE> queue;
+	size_t head = 0;
+	size_t queued = 0;
+
+	std::atomic<uint64_t> framesSent = 0;
+	std::atomic<uint64_t> framesReceived = 0;
+	std::atomic<uint64_t> bytesSent = 0;
+	std::atomic<uint64_t> bytesReceived = 0;
+	std::atomic<uint64_t> errors = 0;
+
+	std::atomic<bool> stopped = false;
+	std::atomic<bool> closed = false;
+	std::mutex mutex;
+	std::condition_variable condition;
+	std::thread inThread;
+	std::thread outThread;
+};
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "pch.h"
+#include "Endpoint.h"
+
+#define WRITE_FLUSH_FREQUENCY 100.f		// Writes to the same endpoint within one tick are collapsed to the latest value
+
+enum class WriteMode {
+	ACKNOWLEDGED,		// The device confirms the write, for configuration values
+	UNACKNOWLEDGED		// Fire and forget with an expected response size of 0, for high-rate setpoints
+};
+
+// Setpoints are streamed while dragging values around, losing one of them does not matter because the next one follows
+static inline WriteMode getDefaultWriteMode(const std::string& identifier) {
+	static const std::vector<std::string> setpoints = { "input_pos", "input_vel", "input_torque" };
+	for (auto& setpoint : setpoints) {
+		if (identifier.length() >= setpoint.length() &&
+			identifier.compare(identifier.length() - setpoint.length(), setpoint.length(), setpoint) == 0) {
+			return WriteMode::UNACKNOWLEDGED;
+		}
+	}
+	return WriteMode::ACKNOWLEDGED;
+}
+
+struct PendingWrite {
+	uint16_t endpoint = 0;
+	EndpointValue value;
+	WriteMode mode = WriteMode::ACKNOWLEDGED;
+};
+
+// Latest pending value per endpoint. Endpoints are flushed in the order they were first written,
+// so e.g. a control mode still goes out before the setpoint that depends on it.
+class WriteQueue {
+public:
+
+	void push(uint16_t endpoint, const EndpointValue& value, WriteMode mode) {
+		std::lock_guard<std::mutex> lock(mutex);
+		auto it = std::find_if(writes.begin(), writes.end(), [&](auto& w) { return w.endpoint == endpoint; });
+		if (it != writes.end()) {
+			it->value = value;
+			it->mode = mode;
+			return;
+		}
+		writes.push_back({ endpoint, value, mode });
+	}
+
+	// Take everything that is pending, the queue is empty afterwards
+	std::vector<PendingWrite> take() {
+		std::lock_guard<std::mutex> lock(mutex);
+		std::vector<PendingWrite> pending;
+		pending.swap(writes);
+		return pending;
+	}
+
+	bool empty() {
+		std::lock_guard<std::mutex> lock(mutex);
+		return writes.empty();
+	}
+
+private:
+	std::vector<PendingWrite> writes;
+	std::mutex mutex;
+};
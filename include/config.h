@@ -3,7 +3,7 @@
 #define CONTROL_PANEL_WIDTH 700
 #define STATUS_BAR_HEIGHT 45
 #define STATUS_BAR_ELEMENTS_WIDTH 270
-#define ODRIVE_POPUP_HEIGHT 370
+#define ODRIVE_POPUP_HEIGHT 395
 #define ENDPOINT_SELECTOR_WIDTH 400
 
 #define RED			IMGUI_COLOR(255, 0, 0, 255)
@@ -1,4 +1,3 @@
-
 #include <iostream>
-#include "Battery/Battery.h"
+#include "Runtime.h"		// BatteryEngine, or what the protocol stack needs without it
 #include "enum.h"
@@ -97,3 +97,4 @@ project (projectName)
 
 
     linkoptions { "/IGNORE:4099" }  -- Ignore warning that no .pdb file is found for debugging
+
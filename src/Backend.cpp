@@ -6,111 +6,227 @@
 
 std::unique_ptr<Backend> backend;
 
-Backend::Backend() {
+Backend::Backend() : descriptorCache(Battery::GetExecutableDirectory() + DESCRIPTOR_CACHE_DIRECTORY) {
 	importEntries(Battery::GetExecutableDirectory() + "endpoints.json");
+	hotplug = std::make_unique<UsbHotplug>(ODRIVE_VENDOR_ID, ODRIVE_PRODUCT_ID);
 	usbListener = std::thread(std::bind(&Backend::listenerThread, this));
+	writer = std::thread(std::bind(&Backend::writerThread, this));
 }
 
 Backend::~Backend() {
 	exportEntries(Battery::GetExecutableDirectory() + "endpoints.json");
 	stopListener = true;
+	hotplug->wake();
 	LOG_DEBUG("Waiting for USB listener to join");
 	usbListener.join();
+
+	{
+		std::lock_guard<std::mutex> lock(probeMutex);
+		for (auto& probe : probes) {
+			probe.join();
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(writerMutex);
+		stopWriter = true;
+	}
+	writerCondition.notify_all();
+	writer.join();
 }
 
+// Scans when a device was plugged in, or regularly where there are no hotplug events. All devices found in
+// one scan are probed at the same time, and the next scan waits until they are done, so none is probed twice.
 void Backend::listenerThread() {
 	while (!stopListener) {
 		auto& devices = libusbcpp::findDevice(context, ODRIVE_VENDOR_ID, ODRIVE_PRODUCT_ID);
-		for (auto& device : devices) {
-			try {
-
-				LOG_DEBUG("New device connected, probing...");
-				std::shared_ptr<ODrive> odrive = std::make_shared<ODrive>(device);
-				odrive->getSerialNumber();
 
-				while (deviceWaiting) {
-					Battery::Sleep(USB_SCAN_INTERVAL);
+		std::vector<std::thread> scanProbes;
+		for (auto& device : devices) {
+			scanProbes.emplace_back([this, device] {
+				try {
+					LOG_DEBUG("New device connected, probing...");
+					std::shared_ptr<ODrive> odrive = std::make_shared<ODrive>(std::make_unique<UsbTransport>(device), &descriptorCache);
+					odrive->getSerialNumber();
+					readyDevices.push(odrive);
+				}
+				catch (const std::exception& e) {
+					LOG_ERROR("Failed to connect device: {}", e.what());
 				}
-				std::lock_guard<std::mutex> lock(temporaryDeviceMutex);
-				temporaryDevice = odrive;
-				deviceWaiting = true;
+			});
+		}
+		for (auto& probe : scanProbes) {
+			probe.join();
+		}
+
+		if (hotplug->isSupported()) {
+			if (hotplug->waitForArrival(USB_HOTPLUG_RESCAN_INTERVAL)) {
+				Battery::Sleep(USB_HOTPLUG_SETTLE_TIME);
+				hotplug->waitForArrival(0);		// Several devices plugged in at once are picked up by the same scan
 			}
-			catch (const std::exception& e) {
-				LOG_ERROR("Failed to connect device: {}", e.what());
+		}
+		else {
+			hotplug->waitForArrival(USB_SCAN_INTERVAL);		// Only returns early when stopping
+		}
+	}
+}
+
+// Sleeps until a write was queued, then sends everything once per tick. While a tick passes, new writes
+// to the same endpoint replace the pending ones, so a stream of setpoints never backs up on the link.
+void Backend::writerThread() {
+	while (true) {
+		std::unordered_set<std::string> written;
+		{
+			std::unique_lock<std::mutex> lock(writerMutex);
+			writerCondition.wait(lock, [&] {
+				auto devices = odrives.getAll();
+				return stopWriter || std::any_of(devices->begin(), devices->end(), [](auto& o) { return o && o->hasPendingWrites(); });
+			});
+			if (stopWriter)
+				break;
+			written.swap(writtenEndpoints);
+		}
+
+		size_t count = 0;
+		for (auto& odrive : *odrives.getAll()) {
+			if (odrive) {
+				count += odrive->flushWrites();
 			}
 		}
-		Battery::Sleep(USB_SCAN_INTERVAL);
+		if (count > 0) {		// Show the new values right away, only the entries that were written skip their rate
+			scheduler.markDue(*entries.getAll(), written);
+			wakeEntryUpdate();
+		}
+
+		Battery::Sleep(1.f / WRITE_FLUSH_FREQUENCY);
 	}
 }
 
 void Backend::handleNewDevices() {
-	if (deviceWaiting) {
-		std::lock_guard<std::mutex> lock(temporaryDeviceMutex);
-		connectDevice(temporaryDevice);
-		temporaryDevice.reset();
-		deviceWaiting = false;
+	std::shared_ptr<ODrive> odrive;
+	while (readyDevices.pop(odrive)) {
+		connectDevice(odrive);
 	}
 }
 
-void Backend::connectDevice(std::shared_ptr<ODrive> odrv) {
+void Backend::handleCompletions() {
+	commands.poll();
+}
 
-	// Check if a device with the same serial number is already known
-	int index = -1;
-	for (int i = 0; i < MAX_NUMBER_OF_ODRIVES; i++) {
-		if (odrives[i]) {
-			if (odrives[i]->serialNumber == odrv->serialNumber) {
-				index = i;
-				break;
-			}
+void Backend::probeDevice(const std::string& description, std::function<std::shared_ptr<ODrive>()> open) {
+	std::lock_guard<std::mutex> lock(probeMutex);
+	probes.emplace_back([this, description, open] {
+		try {
+			LOG_DEBUG("Connecting {}", description);
+			auto odrive = open();
+			odrive->getSerialNumber();
+			readyDevices.push(odrive);
 		}
-	}
-
-	if (index == -1) {	// Device is not known yet, choose an empty slot
-		for (int i = 0; i < MAX_NUMBER_OF_ODRIVES; i++) {
-			if (!odrives[i]) {
-				index = i;
-				break;
-			}
+		catch (const std::exception& e) {
+			LOG_ERROR("Failed to connect {}: {}", description, e.what());
 		}
-	}
+	});
+}
 
-	if (index == -1) {
-		LOG_ERROR("Device can't be connected: No slot is available!");
-		return;
-	}
+void Backend::connectSerialDevice(const std::string& port, uint32_t baudrate) {
+	probeDevice(fmt::format("device on serial port {} at {} baud", port, baudrate), [this, port, baudrate] {
+		return std::make_shared<ODrive>(std::make_unique<SerialTransport>(port, baudrate), &descriptorCache);
+	});
+}
+
+void Backend::connectSimulatedDevice(uint64_t serialNumber, double latency) {
+	probeDevice(fmt::format("simulated device with serial number 0x{:08X}", serialNumber), [serialNumber, latency] {
+		auto model = std::make_shared<SoftwareODrive>(SoftwareODrive::defaultDescriptor(), serialNumber);
+		return std::make_shared<ODrive>(std::make_unique<LoopbackTransport>(model, latency));
+	});
+}
+
+void Backend::connectDevice(std::shared_ptr<ODrive> odrv) {
 
 	if (odrv->serialNumber == 0) {
 		LOG_ERROR("Device can't be connected: Cannot read serial number!");
 		return;
 	}
 
-	odrv->setODriveID(index);
-
-	odrives[index] = odrv;	// Transfer ownership into the odrives array
-
+	int index = odrives.add(odrv);		// Same ID as before if the device was already connected once
+	odrv->setDisconnectCallback([this, index] { odriveDisconnected(index); });
 	LOG_INFO("Device with serial number 0x{:08X} connected as odrv{}", odrv->serialNumber, index);
+
+	// The new instance may have another JSON definition than the one before
+	for (auto& entry : *entries.getAll()) {
+		if (entry->endpoint->odriveID == index) {
+			bindEntry(*entry);
+		}
+	}
 }
 
 void Backend::addEntry(const Entry& entry) {
 	LOG_INFO("Adding endpoint entry {}", entry.endpoint.basic.fullPath);
-	entries.push_back(entry);
+	auto e = std::make_shared<Entry>(entry);
+	bindEntry(*e);
+	entries.add(std::move(e));
+}
+
+// Once when the entry or its device shows up, so the poller and the writes never look up strings. An endpoint
+// the device does not have gets an invalid handle, is logged once here and simply not read afterwards.
+void Backend::bindEntry(Entry& entry) {
+	auto odrive = odrives.get(entry.endpoint->odriveID);
+	std::function<void(Endpoint&)> bind = [&](Endpoint& ep) {
+		ep->handle.set((odrive && odrive->loaded && ep->type != EndpointType::FUNCTION) ? odrive->findEndpoint(ep->identifier) : EndpointHandle());
+		for (auto& input : ep.inputs) bind(input);
+		for (auto& output : ep.outputs) bind(output);
+	};
+	bind(entry.endpoint);
 }
 
 void Backend::removeEntry(const std::string& fullPath) {
 	LOG_INFO("Removing endpoint entry {}", fullPath);
-	for (size_t i = 0; i < entries.size(); i++) {
-		if (entries[i].endpoint->fullPath == fullPath) {
-			entries.erase(entries.begin() + i);
-			return;
-		}
+	entries.remove(fullPath);
+}
+
+double Backend::updateEntryCache() {
+
+	// Collect the endpoints of the entries that are due and read them in a single batch. The snapshot keeps the
+	// entries and their endpoints alive until the cycle is done, even if they are removed meanwhile.
+	auto snapshot = entries.getAll();
+	auto due = scheduler.collectDue(*snapshot, Battery::GetRuntime(), refreshAllEntries.exchange(false));
+	std::vector<const BasicEndpoint*> eps;
+	for (auto& e : due) {
+		e->appendEndpoints(eps);
+	}
+
+	std::vector<EndpointValue> values = readEndpointsDirect(eps);
+
+	double now = Battery::GetRuntime();
+	size_t index = 0;
+	for (auto& e : due) {
+		size_t count = e->getEndpointCount();
+		bool success = std::any_of(values.begin() + index, values.begin() + index + count, [](auto& v) { return v.type() != EndpointValueType::INVALID; });
+		e->updateValues(values.data() + index, now);
+		scheduler.sampled(*e, now, success);
+		index += count;
 	}
+
+	return scheduler.getWaitTime(*snapshot, Battery::GetRuntime());
 }
 
-void Backend::updateEntryCache() {
+void Backend::requestEntryUpdate() {
+	refreshAllEntries = true;
+	wakeEntryUpdate();
+}
 
-	for (Entry& e : entries) {
-		e.updateValue();
+void Backend::wakeEntryUpdate() {
+	{
+		std::lock_guard<std::mutex> lock(entryUpdateMutex);
+		entryUpdateRequested = true;
 	}
+	entryUpdateCondition.notify_all();
+}
+
+void Backend::waitForEntryUpdate(double timeout) {
+	std::unique_lock<std::mutex> lock(entryUpdateMutex);
+	entryUpdateCondition.wait_for(lock, std::chrono::duration<double>(timeout), [&] { return entryUpdateRequested; });
+	entryUpdateRequested = false;
 }
 
 void Backend::importEntries(std::string path) {
@@ -129,14 +245,15 @@ void Backend::importEntries(std::string path) {
 		return;
 	}
 
-	// Now import it
-	entries.clear();
+	// Now import it, the new entries replace the old ones all at once
+	EntryStore::List imported;
 	try {
 		njson json = njson::parse(file.content());
 		for (njson entry : json) {
-			Entry e(entry);
-			if (e.endpoint->id != -1) {
-				addEntry(e);
+			auto e = std::make_shared<Entry>(entry);
+			if (e->endpoint->id != -1) {
+				bindEntry(*e);
+				imported.push_back(e);
 			}
 			else {
 				LOG_WARN("Failed to import an entry: JSON definition was invalid!");
@@ -145,15 +262,17 @@ void Backend::importEntries(std::string path) {
 	}
 	catch (...) {
 		LOG_ERROR("Error while importing: Not a valid JSON file!");
+		entries.clear();
 		return;
 	}
+	entries.replace(std::move(imported));
 	LOG_DEBUG("Done");
 }
 
 void Backend::exportEntries(const std::string& file) {
 	nlohmann::json json = nlohmann::json::array();
-	for (Entry& e : entries) {
-		json.push_back(e.toJson());
+	for (auto& e : *entries.getAll()) {
+		json.push_back(e->toJson());
 	}
 	std::string content = json.dump(4);
 
@@ -170,13 +289,14 @@ void Backend::loadDefaultEntries() {
 	std::string file = DEFAULT_ENTRIES_JSON;
 
 	LOG_DEBUG("Loading default entries...");
-	entries.clear();
+	EntryStore::List defaults;
 	try {
 		njson json = njson::parse(file);
 		for (njson entry : json) {
-			Entry e(entry);
-			if (e.endpoint->id != -1) {
-				addEntry(e);
+			auto e = std::make_shared<Entry>(entry);
+			if (e->endpoint->id != -1) {
+				bindEntry(*e);
+				defaults.push_back(e);
 			}
 			else {
 				LOG_WARN("Failed to import an entry: JSON definition was invalid!");
@@ -185,37 +305,111 @@ void Backend::loadDefaultEntries() {
 	}
 	catch (...) {
 		LOG_ERROR("Error while importing: Not a valid JSON file!");
+		entries.clear();
 		return;
 	}
+	entries.replace(std::move(defaults));
 	LOG_DEBUG("Done");
 }
 
 void Backend::executeFunction(int odriveID, const std::string& identifier) {
 
-	if (!odrives[odriveID])
+	auto odrive = odrives.get(odriveID);
+	if (!odrive)
 		return;
 
-	odrives[odriveID]->executeFunction(identifier);
+	odrive->executeFunction(identifier);
+}
+
+void Backend::updateErrors() {
+	auto devices = odrives.getAll();
+	for (size_t i = 0; i < devices->size(); i++) {
+		auto odrive = (*devices)[i];
+		if (!odrive)
+			continue;
+
+		// The device may be gone or replaced by the time the errors arrive
+		std::weak_ptr<ODrive> device = odrive;
+		post((int)i, "errors", [](ODrive& o) { return o.readErrors(); }, [device](std::vector<EndpointValue> errors) {
+			if (auto odrive = device.lock()) {
+				odrive->setErrors(errors);
+			}
+		});
+	}
 }
 
+void Backend::exportEndpoints(int odriveID) {
+	post(odriveID, "export", [](ODrive& o) { return o.generateEndpointHeader(); }, [](std::string file) {
+		Battery::SaveFileWithDialog("h", file, Battery::GetMainWindow());
+	});
+}
+
+// Called from the thread that noticed it, the pending requests of the device are already cancelled at this point
 void Backend::odriveDisconnected(int odriveID) {
 	LOG_ERROR("Lost connection to odrv{}", odriveID);
+	requestEntryUpdate();		// The entries of the device show as invalid right away
 }
 
 void Backend::updateEndpointCache(int odriveID) {
 
-	if (!odrives[odriveID])
-		return;
+	bool queued = post(odriveID, "endpoints", [](ODrive& odrive) {
+
+		auto endpoints = odrive.endpoints;
+		const EndpointTable& table = *endpoints;
+		std::vector<uint32_t> indices;
+		for (uint32_t i = 0; i < table.size(); i++) {
+			if (EndpointValue(table.getType(i)).size() > 0) {		// It's a numeric type, objects and functions have no value
+				indices.push_back(i);
+			}
+		}
+
+		// The reads are pipelined, always one window ahead of the one awaited. A lost one is sent again like in
+		// ODrive::readMany(), which also reports it to the circuit breaker. After a few of them, or once the device
+		// is gone or stopped responding, the rest is not even sent.
+		std::map<std::string, EndpointValue> values;
+		std::vector<std::shared_ptr<PendingRequest>> requests(indices.size());
+		size_t submitted = 0;
+		size_t timeouts = 0;
+		for (size_t i = 0; i < indices.size(); i++) {
+			for (; submitted < indices.size() && submitted < i + ODRIVE_DEFAULT_MAX_IN_FLIGHT; submitted++) {
+				uint32_t index = indices[submitted];
+				requests[submitted] = odrive.submitRead(table.getId(index), (uint16_t)EndpointValue(table.getType(index)).size());
+			}
+
+			auto& request = requests[i];
+			if (!request)
+				break;		// Disconnected, or the breaker is open
+
+			if (!odrive.awaitResponse(request)) {
+				if (request->error == RequestError::CANCELLED)
+					break;
+
+				uint16_t size = request->expectedResponseSize;
+				uint16_t id = table.getId(indices[i]);
+				request = odrive.requestWithRetries([&] { return odrive.submitRead(id, size); });
+				if (!request) {
+					if (++timeouts >= ENDPOINT_CACHE_MAX_TIMEOUTS || !odrive.isResponding())
+						break;
+					continue;
+				}
+			}
 
-	// Loop through every endpoint of the odrive
-	cachedEndpointValues.clear();
-	for (BasicEndpoint& ep : odrives[odriveID]->cachedEndpoints) {
-		if (ep.type != "function") {	// It's a numeric type, objects are not in the cached list	
-			EndpointValue& value = readEndpointDirect(ep);
-			if (value.type() != EndpointValueType::INVALID) {
-				cachedEndpointValues.emplace(ep.fullPath, value);
+			EndpointValue value(table.getType(indices[i]));
+			if (value.fromBuffer(request->response, request->responseSize)) {
+				values.emplace(odrive.getFullPath(indices[i]), value);
 			}
 		}
+
+		for (auto& request : requests) {		// Whatever was sent but not awaited anymore
+			odrive.cancel(request);
+		}
+		return values;
+	}, [this](std::map<std::string, EndpointValue> values) {
+		cachedEndpointValues = std::move(values);
+	});
+
+	if (queued) {
+		cachedEndpointValues.clear();		// Not showing the values of the odrive selected before
 	}
 }
 
@@ -229,31 +423,98 @@ EndpointValue Backend::getCachedEndpointValue(const std::string& fullPath) {
 	return EndpointValue(EndpointValueType::INVALID);
 }
 
-#define READ_ENDPOINT(_type, T)	if (ep.type == _type)	{ T temp = 0; if (readEndpointDirectRaw<T>(ep, &temp)) return EndpointValue(temp); }
+#define READ_ENDPOINT(_type, T)	case _type: { T temp = 0; if (readEndpointDirectRaw<T>(ep, &temp)) return EndpointValue(temp); break; }
 
 EndpointValue Backend::readEndpointDirect(const BasicEndpoint& ep) {
 
-	READ_ENDPOINT("bool", bool);
-	READ_ENDPOINT("float", float);
-	READ_ENDPOINT("uint8", uint8_t);
-	READ_ENDPOINT("uint16", uint16_t);
-	READ_ENDPOINT("uint32", uint32_t);
-	READ_ENDPOINT("uint64", uint64_t);
-	READ_ENDPOINT("int32", int32_t);
+	switch (ep.type) {
+	READ_ENDPOINT(EndpointType::BOOL, bool);
+	READ_ENDPOINT(EndpointType::FLOAT, float);
+	READ_ENDPOINT(EndpointType::UINT8, uint8_t);
+	READ_ENDPOINT(EndpointType::UINT16, uint16_t);
+	READ_ENDPOINT(EndpointType::UINT32, uint32_t);
+	READ_ENDPOINT(EndpointType::UINT64, uint64_t);
+	READ_ENDPOINT(EndpointType::INT32, int32_t);
+	default: break;
+	}
 
 	return EndpointValue(EndpointValueType::INVALID);
 }
 
-void Backend::writeEndpointDirect(const BasicEndpoint& ep, const EndpointValue& value) {
-	switch (value.type()) {
-	case EndpointValueType::BOOL:	writeEndpointDirectRaw(ep, value.get<bool>()); break;
-	case EndpointValueType::FLOAT:	writeEndpointDirectRaw(ep, value.get<float>()); break;
-	case EndpointValueType::UINT8:	writeEndpointDirectRaw(ep, value.get<uint8_t>()); break;
-	case EndpointValueType::UINT16:	writeEndpointDirectRaw(ep, value.get<uint16_t>()); break;
-	case EndpointValueType::UINT32:	writeEndpointDirectRaw(ep, value.get<uint32_t>()); break;
-	case EndpointValueType::UINT64:	writeEndpointDirectRaw(ep, value.get<uint64_t>()); break;
-	case EndpointValueType::INT32:	writeEndpointDirectRaw(ep, value.get<int32_t>()); break;
+// Only ever reads from the device the job runs on. Going through the registry again could reach a replacement
+// instance, or release the last reference to this one on its own worker, which would then join itself.
+bool Backend::readEndpointAsync(const BasicEndpoint& ep, const std::string& key, std::function<void(EndpointValue)> done) {
+	EndpointHandle handle = ep.handle.get();
+	return post(ep.odriveID, key, [handle](ODrive& odrive) {
+		return odrive.readMany(std::vector<EndpointHandle>{ handle })[0];
+	}, std::move(done));
+}
+
+std::vector<EndpointValue> Backend::readEndpointsDirect(const std::vector<const BasicEndpoint*>& eps) {
+
+	std::vector<EndpointValue> values(eps.size());
+
+	// Hand one batch to the worker of every odrive first, so they all run at the same time
+	struct Batch {
+		std::shared_ptr<ODrive> odrive;
+		std::vector<size_t> indices;
+		std::future<std::vector<EndpointValue>> results;
+	};
+	std::vector<Batch> batches;
+
+	// Sort everything by odrive in one pass, so the cost does not grow with the number of devices times entries
+	auto devices = odrives.getAll();
+	std::vector<std::vector<size_t>> perDevice(devices->size());
+	for (size_t j = 0; j < eps.size(); j++) {
+		int id = eps[j]->odriveID;
+		if (id >= 0 && id < (int)devices->size() && eps[j]->type != EndpointType::FUNCTION) {
+			perDevice[id].push_back(j);
+		}
+	}
+
+	for (size_t i = 0; i < devices->size(); i++) {
+		auto& odrive = (*devices)[i];
+		if (!odrive || perDevice[i].empty() || !odrive->isAvailable())	// Otherwise it would queue up behind a running probe
+			continue;
+
+		std::vector<EndpointHandle> handles;		// Bound with the entry, see bindEntry()
+		for (size_t j : perDevice[i]) {
+			handles.push_back(eps[j]->handle.get());
+		}
+		batches.push_back({ odrive, std::move(perDevice[i]), odrive->readManyAsync(std::move(handles)) });
+	}
+
+	// And join them, this takes as long as the slowest device and not as long as all of them together
+	for (auto& batch : batches) {
+		std::vector<EndpointValue> results = batch.results.get();
+		for (size_t j = 0; j < batch.indices.size(); j++) {
+			values[batch.indices[j]] = results[j];
+		}
+	}
+
+	return values;
+}
+
+void Backend::queueWrite(const BasicEndpoint& ep, const EndpointValue& value) {
+	queueWrite(ep, value, getDefaultWriteMode(ep.identifier));
+}
+
+void Backend::queueWrite(const BasicEndpoint& ep, const EndpointValue& value, WriteMode mode) {
+
+	auto odrive = odrives.get(ep.odriveID);
+	if (!odrive || value.size() == 0)
+		return;
+
+	if (!odrive->queueWrite(ep.handle.get(), value, mode))
+		return;
+
+	LOG_DEBUG("Queued write of {} to endpoint {}", value.toString(), ep.fullPath);
+
+	{
+		std::lock_guard<std::mutex> lock(writerMutex);		// Not lost between the check and the wait of the writer
+		writtenEndpoints.insert(ep.fullPath);
 	}
+	writerCondition.notify_all();
 }
 
 const char* DEFAULT_ENTRIES_JSON = " \
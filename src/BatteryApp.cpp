@@ -4,8 +4,6 @@
 #include "Battery/AllegroDeps.h"
 #include "Backend.h"
 
-#define UPDATE_CACHE_FREQUENCY 5.f
-
 BatteryApp::BatteryApp() : Battery::Application(1280, 720, "ODriveGui") {
 	LOG_SET_LOGLEVEL(BATTERY_LOG_LEVEL_DEBUG);
 	libusbcpp::setLogLevel(libusbcpp::LOG_LEVEL_INFO);
@@ -13,6 +11,9 @@ BatteryApp::BatteryApp() : Battery::Application(1280, 720, "ODriveGui") {
 
 bool BatteryApp::OnStartup() {
 
+	int simulatedDevices = 0;
+	std::vector<std::string> serialPorts;
+	uint32_t baudrate = SERIAL_DEFAULT_BAUDRATE;
 	for (size_t i = 1; i < args.size(); i++) {
 		if (args[i] == "--verbose") {
 			LOG_SET_LOGLEVEL(BATTERY_LOG_LEVEL_DEBUG);
@@ -24,24 +25,43 @@ bool BatteryApp::OnStartup() {
 			libusbcpp::setLogLevel(libusbcpp::LOG_LEVEL_TRACE);
 			LOG_INFO("Trace logging enabled, set log level to LOG_LEVEL_TRACE");
 		}
+		else if (args[i].rfind("--simulate=", 0) == 0) {
+			simulatedDevices = std::max(std::atoi(args[i].c_str() + strlen("--simulate=")), 0);
+			LOG_INFO("Simulating {} ODrive(s) in software", simulatedDevices);
+		}
+		else if (args[i].rfind("--serial=", 0) == 0) {
+			serialPorts.push_back(args[i].substr(strlen("--serial=")));
+		}
+		else if (args[i].rfind("--baudrate=", 0) == 0) {
+			baudrate = (uint32_t)std::atoi(args[i].c_str() + strlen("--baudrate="));
+		}
 		else {
 			LOG_ERROR("[{}]: Unknown parameter! Available:", args[i]);
 			LOG_ERROR("                                       --verbose  -> Debug logging");
 			LOG_ERROR("                                       --trace    -> All the logging");
+			LOG_ERROR("                                       --simulate=N -> Connect N simulated ODrives");
+			LOG_ERROR("                                       --serial=PORT -> Connect an ODrive over UART, can be repeated");
+			LOG_ERROR("                                       --baudrate=N -> Baudrate for --serial, default {}", SERIAL_DEFAULT_BAUDRATE);
 			CloseApplication();
 		}
 	}
 
 	window.SetTitle("ODriveGui");
 	backend = std::make_unique<Backend>();
+	for (int i = 0; i < simulatedDevices; i++) {
+		backend->connectSimulatedDevice(0x5100000000 + i);
+	}
+	for (auto& port : serialPorts) {
+		backend->connectSerialDevice(port, baudrate);
+	}
 
 	ui = std::make_shared<UserInterface>();
 	PushOverlay(ui);
 
 	backendUpdateThread = std::thread([&] { 
 		while (!shouldClose) { 
-			backend->updateEntryCache();
-			Battery::Sleep(1.f / UPDATE_CACHE_FREQUENCY);
+			double wait = backend->updateEntryCache();
+			backend->waitForEntryUpdate(wait);	// Until the next entry is due, or earlier when a write changed something
 		} 
 	});
 
@@ -50,13 +70,10 @@ bool BatteryApp::OnStartup() {
 
 void BatteryApp::OnUpdate() {
 	backend->handleNewDevices();
-	// Request all errors as a health check of the connection
+	backend->handleCompletions();
+	// Request all errors as a health check of the connection, they are shown once they arrived
 	if (framecount % 30 == 1) {
-		for (int i = 0; i < MAX_NUMBER_OF_ODRIVES; i++) {
-			if (backend->odrives[i]) {
-				backend->odrives[i]->updateErrors();
-			}
-		}
+		backend->updateErrors();
 	}
 }
 
@@ -69,7 +69,10 @@ uint16_t CRC16(uint8_t* data, size_t len) {
 }
 
 uint16_t CRC16_JSON(uint8_t* data, size_t len) {
-    uint16_t crc = 1;
+    return CRC16_JSON_Update(1, data, len);
+}
+
+uint16_t CRC16_JSON_Update(uint16_t crc, const uint8_t* data, size_t len) {
     static const uint16_t table[] = {
       0x0000, 0x3D65, 0x7ACA, 0x47AF, 0xF594, 0xC8F1, 0x8F5E, 0xB23B, 0xD64D, 0xEB28, 0xAC87, 0x91E2, 0x23D9, 0x1EBC, 0x5913, 0x6476,
       0x91FF, 0xAC9A, 0xEB35, 0xD650, 0x646B, 0x590E, 0x1EA1, 0x23C4, 0x47B2, 0x7AD7, 0x3D78, 0x001D, 0xB226, 0x8F43, 0xC8EC, 0xF589,
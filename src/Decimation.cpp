@@ -0,0 +1,199 @@
+#include "pch.h"
+#include "Decimation.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DECIMATION_SSE2
+#include <emmintrin.h>
+#endif
+
+void findMinMax(const double* values, size_t count, double* min, double* max) {
+
+	size_t i = 0;
+	double lo = values[0];
+	double hi = values[0];
+
+#ifdef DECIMATION_SSE2
+	if (count >= 4) {
+		// Two independent accumulators, so consecutive iterations do not wait for each other
+		__m128d lo0 = _mm_loadu_pd(values);
+		__m128d hi0 = lo0;
+		__m128d lo1 = _mm_loadu_pd(values + 2);
+		__m128d hi1 = lo1;
+		for (i = 4; i + 4 <= count; i += 4) {
+			__m128d a = _mm_loadu_pd(values + i);
+			__m128d b = _mm_loadu_pd(values + i + 2);
+			lo0 = _mm_min_pd(lo0, a);
+			hi0 = _mm_max_pd(hi0, a);
+			lo1 = _mm_min_pd(lo1, b);
+			hi1 = _mm_max_pd(hi1, b);
+		}
+		lo0 = _mm_min_pd(lo0, lo1);
+		hi0 = _mm_max_pd(hi0, hi1);
+		lo = std::min(_mm_cvtsd_f64(lo0), _mm_cvtsd_f64(_mm_unpackhi_pd(lo0, lo0)));
+		hi = std::max(_mm_cvtsd_f64(hi0), _mm_cvtsd_f64(_mm_unpackhi_pd(hi0, hi0)));
+	}
+#endif
+
+	for (; i < count; i++) {
+		lo = std::min(lo, values[i]);
+		hi = std::max(hi, values[i]);
+	}
+
+	*min = lo;
+	*max = hi;
+}
+
+size_t decimateMinMax(const double* x, const double* y, size_t count, double xMin, double xMax,
+					  DecimatedColumn* out, size_t columns) {
+
+	if (columns == 0 || !(xMax > xMin)) {
+		return 0;
+	}
+
+	double width = (xMax - xMin) / columns;
+	const double* begin = std::lower_bound(x, x + count, xMin);
+	const double* start = begin;
+	for (size_t c = 0; c < columns; c++) {
+		double edge = (c + 1 == columns) ? xMax : xMin + (c + 1) * width;
+		const double* end = std::lower_bound(start, x + count, edge);
+
+		DecimatedColumn& column = out[c];
+		column.count = end - start;
+		if (column.count > 0) {
+			size_t first = start - x;
+			findMinMax(y + first, column.count, &column.min, &column.max);
+			column.first = y[first];
+			column.last = y[first + column.count - 1];
+		}
+		start = end;
+	}
+
+	return start - begin;
+}
+
+// The sample in [from, to) that spans the largest triangle with the point a and the point c
+static size_t findLargestTriangle(const double* x, const double* y, size_t from, size_t to,
+								  double ax, double ay, double cx, double cy) {
+
+	// Twice the area is |(ax - cx) * (by - ay) - (ax - bx) * (cy - ay)|, which is |dx * by + dy * bx - k|
+	double dx = ax - cx;
+	double dy = cy - ay;
+	double k = dx * ay + dy * ax;
+
+	size_t i = from;
+	double maxArea = -1.0;
+	size_t maxIndex = from;
+
+#ifdef DECIMATION_SSE2
+	if (to - from >= 2) {
+		const __m128d vdx = _mm_set1_pd(dx);
+		const __m128d vdy = _mm_set1_pd(dy);
+		const __m128d vk = _mm_set1_pd(k);
+		const __m128d absMask = _mm_castsi128_pd(_mm_set1_epi64x(0x7FFFFFFFFFFFFFFFLL));
+		const __m128d two = _mm_set1_pd(2.0);
+
+		__m128d bestArea = _mm_set1_pd(-1.0);
+		__m128d bestIndex = _mm_setzero_pd();
+		__m128d index = _mm_set_pd((double)(from + 1), (double)from);		// Exact up to 2^53 samples
+		for (; i + 2 <= to; i += 2) {
+			__m128d bx = _mm_loadu_pd(x + i);
+			__m128d by = _mm_loadu_pd(y + i);
+			__m128d area = _mm_and_pd(_mm_sub_pd(_mm_add_pd(_mm_mul_pd(vdx, by), _mm_mul_pd(vdy, bx)), vk), absMask);
+			__m128d larger = _mm_cmpgt_pd(area, bestArea);
+			bestArea = _mm_max_pd(area, bestArea);
+			bestIndex = _mm_or_pd(_mm_and_pd(larger, index), _mm_andnot_pd(larger, bestIndex));
+			index = _mm_add_pd(index, two);
+		}
+
+		double areas[2];
+		double indices[2];
+		_mm_storeu_pd(areas, bestArea);
+		_mm_storeu_pd(indices, bestIndex);
+		for (int lane = 0; lane < 2; lane++) {		// The lower index wins a tie, like the scalar loop
+			if (areas[lane] > maxArea || (areas[lane] == maxArea && (size_t)indices[lane] < maxIndex)) {
+				maxArea = areas[lane];
+				maxIndex = (size_t)indices[lane];
+			}
+		}
+	}
+#endif
+
+	for (; i < to; i++) {
+		double area = std::abs(dx * y[i] + dy * x[i] - k);
+		if (area > maxArea) {
+			maxArea = area;
+			maxIndex = i;
+		}
+	}
+
+	return maxIndex;
+}
+
+static void findAverage(const double* x, const double* y, size_t from, size_t to, double* avgX, double* avgY) {
+
+	size_t i = from;
+	double sumX = 0.0;
+	double sumY = 0.0;
+
+#ifdef DECIMATION_SSE2
+	__m128d vx = _mm_setzero_pd();
+	__m128d vy = _mm_setzero_pd();
+	for (; i + 2 <= to; i += 2) {
+		vx = _mm_add_pd(vx, _mm_loadu_pd(x + i));
+		vy = _mm_add_pd(vy, _mm_loadu_pd(y + i));
+	}
+	sumX = _mm_cvtsd_f64(vx) + _mm_cvtsd_f64(_mm_unpackhi_pd(vx, vx));
+	sumY = _mm_cvtsd_f64(vy) + _mm_cvtsd_f64(_mm_unpackhi_pd(vy, vy));
+#endif
+
+	for (; i < to; i++) {
+		sumX += x[i];
+		sumY += y[i];
+	}
+
+	*avgX = sumX / (to - from);
+	*avgY = sumY / (to - from);
+}
+
+size_t decimateLTTB(const double* x, const double* y, size_t count, size_t threshold, double* outX, double* outY) {
+
+	threshold = std::max<size_t>(threshold, 3);		// The first, the last and at least one in between
+	if (threshold >= count) {
+		std::copy(x, x + count, outX);
+		std::copy(y, y + count, outY);
+		return count;
+	}
+
+	// The first and the last sample are always kept, everything in between is split into threshold - 2 buckets.
+	// From each bucket, the sample forming the largest triangle with the one picked before and the average of
+	// the next bucket is picked.
+	double every = (double)(count - 2) / (threshold - 2);
+	size_t n = 0;
+	size_t a = 0;
+	outX[n] = x[0];
+	outY[n] = y[0];
+	n++;
+
+	for (size_t bucket = 0; bucket < threshold - 2; bucket++) {
+		size_t from = (size_t)(bucket * every) + 1;
+		size_t to = (size_t)((bucket + 1) * every) + 1;
+		size_t nextFrom = to;
+		size_t nextTo = std::min((size_t)((bucket + 2) * every) + 1, count);
+
+		double cx = x[count - 1];
+		double cy = y[count - 1];
+		if (nextTo > nextFrom) {
+			findAverage(x, y, nextFrom, nextTo, &cx, &cy);
+		}
+
+		a = findLargestTriangle(x, y, from, std::max(to, from + 1), x[a], y[a], cx, cy);
+		outX[n] = x[a];
+		outY[n] = y[a];
+		n++;
+	}
+
+	outX[n] = x[count - 1];
+	outY[n] = y[count - 1];
+	n++;
+	return n;
+}
@@ -0,0 +1,124 @@
+
+#include "pch.h"
+#include "DescriptorCache.h"
+#include "CRC.h"
+
+#include <filesystem>
+
+#include "json.hpp"
+
+// Plain file access, so the cache works without BatteryEngine as well
+static bool readFile(const std::string& path, std::string* content) {
+	std::ifstream file(path, std::ios::binary);
+	if (!file)
+		return false;
+
+	std::stringstream buffer;
+	buffer << file.rdbuf();
+	*content = buffer.str();
+	return true;
+}
+
+static bool writeFile(const std::string& path, const std::string& content) {
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	file << content;
+	return (bool)file;
+}
+
+DescriptorCache::DescriptorCache(const std::string& directory) : directory(directory) {
+	loadIndex();
+}
+
+std::vector<CachedDescriptorInfo> DescriptorCache::getCandidates() {
+	std::lock_guard<std::mutex> lock(mutex);
+
+	std::vector<CachedDescriptorInfo> candidates;
+	for (auto& info : index) {
+		auto known = std::find_if(candidates.begin(), candidates.end(), [&](auto& c) { return c.jsonCRC == info.jsonCRC; });
+		if (known == candidates.end()) {
+			candidates.push_back(info);
+		}
+	}
+	return candidates;
+}
+
+std::string DescriptorCache::loadDescriptor(const CachedDescriptorInfo& info) {
+
+	std::string json;
+	if (!readFile(directory + info.file, &json)) {
+		LOG_WARN("Cached descriptor {} cannot be opened", info.file);
+		return "";
+	}
+
+	if (CRC16_JSON((uint8_t*)json.data(), json.length()) != info.jsonCRC) {
+		LOG_WARN("Cached descriptor {} is corrupted, ignoring it", info.file);
+		return "";
+	}
+
+	return json;
+}
+
+void DescriptorCache::store(CachedDescriptorInfo info, const std::string& json) {
+	std::lock_guard<std::mutex> lock(mutex);
+
+	info.file = fmt::format("{:012X}_{}.json", info.serialNumber, info.firmwareVersion);
+
+	try {
+		std::filesystem::create_directories(directory);
+	}
+	catch (...) {
+		LOG_ERROR("Cannot create the descriptor cache directory {}", directory);
+		return;
+	}
+
+	if (!writeFile(directory + info.file, json)) {
+		LOG_ERROR("Failed to write cached descriptor {}", info.file);
+		return;
+	}
+
+	// Replace an older entry with the same key and move it to the front
+	index.erase(std::remove_if(index.begin(), index.end(), [&](auto& i) { return i.file == info.file; }), index.end());
+	index.insert(index.begin(), info);
+	saveIndex();
+
+	LOG_DEBUG("Stored descriptor of 0x{:08X} in the cache", info.serialNumber);
+}
+
+void DescriptorCache::loadIndex() {
+
+	std::string content;
+	if (!readFile(directory + DESCRIPTOR_CACHE_INDEX, &content))
+		return;		// Nothing cached yet
+
+	try {
+		for (auto& entry : nlohmann::json::parse(content)) {
+			CachedDescriptorInfo info;
+			info.serialNumber = entry["serial_number"];
+			info.firmwareVersion = entry["fw_version"];
+			info.jsonCRC = entry["json_crc"];
+			info.serialNumberEndpoint = entry["serial_number_endpoint"];
+			info.file = entry["file"];
+			index.push_back(info);
+		}
+	}
+	catch (...) {
+		LOG_WARN("Descriptor cache index is invalid, starting with an empty cache");
+		index.clear();
+	}
+}
+
+void DescriptorCache::saveIndex() {
+
+	nlohmann::json json = nlohmann::json::array();
+	for (auto& info : index) {
+		nlohmann::json entry;
+		entry["serial_number"] = info.serialNumber;
+		entry["fw_version"] = info.firmwareVersion;
+		entry["json_crc"] = info.jsonCRC;
+		entry["serial_number_endpoint"] = info.serialNumberEndpoint;
+		entry["file"] = info.file;
+		json.push_back(entry);
+	}
+
+	writeFile(directory + DESCRIPTOR_CACHE_INDEX, json.dump(4));
+}
@@ -6,7 +6,24 @@
 #include "ODriveDocs.h"
 #include "config.h"
 
-static void drawEndpointChildWindow(const std::string& path, const std::string& type, const std::string& value, ImVec4 color, const std::string& enumName, int64_t enumValue, bool changed, size_t entryID) {
+static const float samplingRates[] = { 1.f, 5.f, 10.f, 50.f, 100.f, 500.f, 1000.f };
+
+static ImVec4 getEndpointColor(const Endpoint& ep) {
+	switch (ep->type) {
+	case EndpointType::FLOAT:		return COLOR_FLOAT;
+	case EndpointType::BOOL:		return COLOR_BOOL;
+	default:						return COLOR_UINT;
+	}
+}
+
+static ImGuiInputTextFlags getInputFlags(const Endpoint& ep) {
+	if (ep->type == EndpointType::FLOAT) {
+		return IMGUI_FLAGS_FLOAT;
+	}
+	return IMGUI_FLAGS_INT;
+}
+
+static void drawEndpointChildWindow(const std::string& path, const std::string& type, const std::string& value, ImVec4 color, const std::string& enumName, int64_t enumValue, bool changed, size_t entryID, const std::string& sampling = "") {
 	ImVec4 col = changed ? RED : color;
 	std::string text = (enumName.length() > 0) ? enumName.c_str() : value.c_str();
 
@@ -35,73 +52,110 @@ static void drawEndpointChildWindow(const std::string& path, const std::string&
 			ImGui::TextColored(col, "%s", name.str().c_str(), value);
 		}
 
+		if (sampling.length() > 0) {
+			ImGui::Text("%s", sampling.c_str());
+		}
+
 		ImGui::EndTooltip();
 	}
 }
 
-Entry::Entry(const Endpoint& ep) : endpoint(ep), value(ep.basic.type) {
+Entry::Entry(const Endpoint& ep) : endpoint(ep) {
 	entryID = entryIDCounter;
 	entryIDCounter++;
-	memset(imguiBuffer, 0, sizeof(imguiBuffer));
+	resetValues();
+	createHistory();
 }
 
 Entry::Entry(const nlohmann::json& json) {
 	entryID = entryIDCounter;
 	entryIDCounter++;
-	memset(imguiBuffer, 0, sizeof(imguiBuffer));
 
 	if (!endpoint.fromJson(json)) {
 		endpoint.basic.id = -1;
 	}
+	if (json.contains("rate") && json["rate"].is_number()) {
+		sampling.rate = std::max(json["rate"].get<float>(), ENTRY_MIN_RATE);
+	}
+	resetValues();
+
+	if (json.contains("history") && json["history"].is_number_unsigned()) {
+		historyCapacity = std::max<size_t>(json["history"].get<size_t>(), 1);
+	}
+	createHistory();
 }
 
-void Entry::updateValue() {		// If locking the mutex fails, simply ignore and return
-	try {
-		std::unique_lock<std::mutex> lock(mutex);
+// Only before the entry is shared, the poller and the graph rely on the histories never being replaced
+void Entry::createHistory() {
+	std::vector<const BasicEndpoint*> eps;
+	appendEndpoints(eps);
+	history.resize(eps.size());
+	for (size_t i = 0; i < eps.size(); i++) {
+		history[i] = makeTimeSeries(getValueType(eps[i]->type), historyCapacity);
+	}
+}
 
-		if (endpoint->fullPath == "")
-			return;
+// Until the first cycle: A zero of the right type for the endpoint itself, nothing for the inputs and outputs
+void Entry::resetValues() {
+	auto initial = std::make_shared<EntryValues>();
+	initial->values.resize(getEndpointCount());
+	initial->changed.resize(getEndpointCount(), false);
+	if (!initial->values.empty()) {
+		initial->values[0] = EndpointValue(endpoint->type);
+	}
+	std::atomic_store(&values, std::shared_ptr<const EntryValues>(std::move(initial)));
+}
 
-		// Update the changed flags
-		oldValues[endpoint->fullPath] = value;
-		for (Endpoint& e : endpoint.inputs) {
-			oldValues[e->fullPath] = ioValues[e->fullPath];
-		}
-		for (Endpoint& e : endpoint.outputs) {
-			oldValues[e->fullPath] = ioValues[e->fullPath];
-		}
-		lock.unlock();
-
-		// And now read
-		auto temp = backend->readEndpointDirect(endpoint.basic);
-		if (temp.type() != EndpointValueType::INVALID) {
-			lock.lock();
-			value = temp;
-			lock.unlock();
-		}
+void Entry::appendEndpoints(std::vector<const BasicEndpoint*>& eps) {
 
-		for (Endpoint& e : endpoint.inputs) {
-			auto temp = backend->readEndpointDirect(e.basic);
-			if (temp.type() != EndpointValueType::INVALID) {
-				lock.lock();
-				ioValues[e->fullPath] = temp;
-				lock.unlock();
-			}
+	if (endpoint->fullPath == "")
+		return;
+
+	eps.push_back(&endpoint.basic);
+	for (Endpoint& e : endpoint.inputs) {
+		eps.push_back(&e.basic);
+	}
+	for (Endpoint& e : endpoint.outputs) {
+		eps.push_back(&e.basic);
+	}
+}
+
+// Only called by the poller: Builds the next cycle from the previous one and publishes it.
+// Every value that could be read is also appended to the history of its endpoint.
+void Entry::updateValues(const EndpointValue* values, double time) {
+
+	if (endpoint->fullPath == "")
+		return;
+
+	for (size_t i = 0; i < history.size(); i++) {
+		auto& series = history[i];
+		if (series && values[i].type() != EndpointValueType::INVALID) {
+			series->push(time, values[i]);
 		}
-		for (Endpoint& e : endpoint.outputs) {
-			auto temp = backend->readEndpointDirect(e.basic);
-			if (temp.type() != EndpointValueType::INVALID) {
-				lock.lock();
-				ioValues[e->fullPath] = temp;
-				lock.unlock();
-			}
+	}
+
+	auto previous = getValues();
+	auto next = std::make_shared<EntryValues>(*previous);
+	for (size_t i = 0; i < next->values.size(); i++) {
+		if (values[i].type() != EndpointValueType::INVALID) {
+			next->values[i] = values[i];
 		}
+		next->changed[i] = (next->values[i] != previous->values[i]);
 	}
-	catch (...) {}
+
+	std::atomic_store(&this->values, std::shared_ptr<const EntryValues>(std::move(next)));
+}
+
+size_t Entry::getEndpointCount() const {
+
+	if (endpoint->fullPath == "")
+		return 0;
+
+	return 1 + endpoint.inputs.size() + endpoint.outputs.size();
 }
 
-bool Entry::drawImGuiNumberInputField(const std::string& imguiIdentifier, ImGuiInputTextFlags flags) {
-	return ImGui::InputText(imguiIdentifier.c_str(), imguiBuffer, IMGUI_BUFFER_SIZE, flags);
+bool Entry::drawImGuiNumberInputField(const std::string& imguiIdentifier, char* buffer, ImGuiInputTextFlags flags) {
+	return ImGui::InputText(imguiIdentifier.c_str(), buffer, IMGUI_BUFFER_SIZE, flags);
 }
 
 void Entry::drawImGuiDropdownField(const std::string& imguiIdentifier, const std::vector<std::string>& enumNames) {
@@ -123,6 +177,7 @@ void Entry::drawImGuiNumberInput(Endpoint& ep, bool isfloat) {
 	ImGui::SameLine();
 	bool set = false;
 
+	InputField& field = inputFields[ep->fullPath];
 	EndpointValue writeValue(ep->type);
 	std::vector<std::string> enumNames = ListEnumValues(ep.basic);
 	if (enumNames.size() > 0) {
@@ -134,11 +189,11 @@ void Entry::drawImGuiNumberInput(Endpoint& ep, bool isfloat) {
 	else {
 		ImGui::SetCursorPosX(ImGui::GetWindowContentRegionWidth() - 145);
 		ImGui::PushItemWidth(100);
-		if (drawImGuiNumberInputField("##" + ep->fullPath + std::to_string(entryID), ep.getImGuiFlags())) {
+		if (drawImGuiNumberInputField("##" + ep->fullPath + std::to_string(entryID), field.buffer, getInputFlags(ep))) {
 			set = true;
 			ImGui::SetKeyboardFocusHere(-1);
 		}
-		writeValue.fromString(imguiBuffer);
+		writeValue.fromString(field.buffer);
 	}
 
 	ImGui::PopItemWidth();
@@ -151,8 +206,7 @@ void Entry::drawImGuiNumberInput(Endpoint& ep, bool isfloat) {
 	if (set) {
 		try {
 			if (writeValue.toString().length() > 0) {
-				backend->writeEndpointDirect(ep.basic, writeValue);
-				backend->updateEntryCache();
+				backend->queueWrite(ep.basic, writeValue);
 				LOG_DEBUG("Setting {} to {}", ep->fullPath, writeValue.toString());
 			}
 			else {
@@ -163,11 +217,23 @@ void Entry::drawImGuiNumberInput(Endpoint& ep, bool isfloat) {
 			load = true;
 		}
 	}
-	if (load || std::string(imguiBuffer) == "") {
-		EndpointValue value = backend->readEndpointDirect(ep.basic);
-		if (value.type() != EndpointValueType::INVALID) {
-			strncpy_s(imguiBuffer, value.toString().c_str(), IMGUI_BUFFER_SIZE);
+
+	// The current value is read in the background once the field opens and shows up a few frames later,
+	// unless the user typed something meanwhile
+	if (field.loadedValue->type() != EndpointValueType::INVALID) {
+		if (field.loadedFrom == field.buffer) {
+			strncpy_s(field.buffer, field.loadedValue->toString().c_str(), IMGUI_BUFFER_SIZE);
 		}
+		*field.loadedValue = EndpointValue();
+	}
+	if (load || !field.loadRequested) {
+		std::weak_ptr<EndpointValue> target = field.loadedValue;		// The entry may be removed meanwhile
+		field.loadRequested = backend->readEndpointAsync(ep.basic, "load" + std::to_string(entryID) + ep->fullPath, [target](EndpointValue value) {
+			if (auto loaded = target.lock()) {
+				*loaded = value;
+			}
+		});
+		field.loadedFrom = field.buffer;
 	}
 }
 
@@ -175,43 +241,61 @@ void Entry::drawImGuiBoolInput(Endpoint& ep) {
 	ImGui::SameLine();
 	ImGui::SetCursorPosX(ImGui::GetWindowWidth() - 145);
 	if (ImGui::Button(("false##" + ep->fullPath + std::to_string(entryID)).c_str(), { 60, 0 })) {
-		backend->writeEndpointDirect(ep.basic, false);
-		backend->updateEntryCache();
+		backend->queueWrite(ep.basic, false);
 	}
 	ImGui::SameLine();
 	if (ImGui::Button(("true##" + ep->fullPath + std::to_string(entryID)).c_str(), { 60, 0 })) {
-		backend->writeEndpointDirect(ep.basic, true);
-		backend->updateEntryCache();
+		backend->queueWrite(ep.basic, true);
 	}
 }
 
 void Entry::drawEndpointInput(Endpoint& ep) {
-	if (ep->type == "float") {
-		drawImGuiNumberInput(ep, true);	// Float
+	switch (ep->type) {
+	case EndpointType::FLOAT:	drawImGuiNumberInput(ep, true); break;	// Float
+	case EndpointType::BOOL:	drawImGuiBoolInput(ep); break;			// bool
+	default:					drawImGuiNumberInput(ep, false); break;	// All other ints
 	}
-	else if (ep->type == "bool") {
-		drawImGuiBoolInput(ep);			// bool
-	}
-	else {
-		drawImGuiNumberInput(ep, false);	// All other ints
+}
+
+std::string Entry::getSamplingText() {
+	return fmt::format("Sampled at {:.1f} of {:.1f} Hz, {} deadlines missed (right click to change)",
+		sampling.achievedRate.load(), sampling.rate.load(), sampling.missedDeadlines.load());
+}
+
+// Right click on the value to pick how often it is read
+void Entry::drawSamplingMenu() {
+	if (ImGui::BeginPopupContextItem(("Rate##" + endpoint->fullPath + std::to_string(entryID)).c_str())) {
+		ImGui::Text("Sampling rate");
+		ImGui::Separator();
+		for (float rate : samplingRates) {
+			if (ImGui::Selectable(fmt::format("{:g} Hz", rate).c_str(), sampling.rate == rate)) {
+				sampling.rate = rate;
+				backend->requestEntryUpdate();		// The poller may be sleeping for the old period
+			}
+		}
+		ImGui::EndPopup();
 	}
 }
 
 void Entry::draw() {
-	std::scoped_lock<std::mutex> lock(mutex);
+	auto snapshot = getValues();		// The same cycle for the whole entry, even if the poller publishes the next one meanwhile
+	auto valueAt = [&](size_t index) { return (index < snapshot->values.size()) ? snapshot->values[index] : EndpointValue(); };
+	auto changedAt = [&](size_t index) { return (index < snapshot->changed.size()) ? (bool)snapshot->changed[index] : false; };
 
 	ImGui::SetCursorPosY(ImGui::GetCursorPosY() + 10);
 
-	if (endpoint->type != "function") {	// Numeric values
+	if (endpoint->type != EndpointType::FUNCTION) {	// Numeric values
 
 		if (ImGui::Button(("x##" + endpoint->fullPath + std::to_string(entryID)).c_str(), { 40, 0 })) {
 			toBeRemoved = true;
 		}
 		ImGui::SameLine();
 
-		bool changed = (value != oldValues[endpoint->fullPath]);	// vvv Test if an enum name is available for this endpoint
+		EndpointValue value = valueAt(0);
+		bool changed = changedAt(0);	// vvv Test if an enum name is available for this endpoint
 		const std::string& enumName = EndpointValueToEnumName(endpoint.basic, value.get<int64_t>(), value.type());
-		drawEndpointChildWindow(endpoint->fullPath.c_str(), endpoint->type.c_str(), value.toString(), endpoint.getColor(), enumName, value.get<int64_t>(), changed, entryID);
+		drawEndpointChildWindow(endpoint->fullPath.c_str(), getEndpointTypeName(endpoint->type), value.toString(), getEndpointColor(endpoint), enumName, value.get<int64_t>(), changed, entryID, getSamplingText());
+		drawSamplingMenu();
 		if (!endpoint->readonly) {
 			drawEndpointInput(endpoint);
 		}
@@ -241,12 +325,12 @@ void Entry::draw() {
 		}
 		for (size_t j = 0; j < endpoint.inputs.size(); j++) {
 			Endpoint& ep = endpoint.inputs[j];
-			auto& value = ioValues[ep->fullPath];
+			EndpointValue value = valueAt(1 + j);
 
 			ImGui::SetCursorPosX(120);
 
-			bool changed = (value != oldValues[ep->fullPath]);
-			drawEndpointChildWindow(ep->identifier.c_str(), ep->type.c_str(), value.toString(), ep.getColor(), "", 0, changed, entryID);
+			bool changed = changedAt(1 + j);
+			drawEndpointChildWindow(ep->identifier.c_str(), getEndpointTypeName(ep->type), value.toString(), getEndpointColor(ep), "", 0, changed, entryID);
 			if (!ep->readonly) {
 				drawEndpointInput(ep);
 			}
@@ -261,12 +345,12 @@ void Entry::draw() {
 		}
 		for (size_t j = 0; j < endpoint.outputs.size(); j++) {
 			Endpoint& ep = endpoint.outputs[j];
-			auto& value = ioValues[ep->fullPath];
+			EndpointValue value = valueAt(1 + endpoint.inputs.size() + j);
 
 			ImGui::SetCursorPosX(120);
 
-			bool changed = (value != oldValues[ep->fullPath]);
-			drawEndpointChildWindow(ep->identifier.c_str(), ep->type.c_str(), value.toString(), ep.getColor(), "", 0, changed, entryID);
+			bool changed = changedAt(1 + endpoint.inputs.size() + j);
+			drawEndpointChildWindow(ep->identifier.c_str(), getEndpointTypeName(ep->type), value.toString(), getEndpointColor(ep), "", 0, changed, entryID);
 			if (!ep->readonly) {
 				drawEndpointInput(ep);
 			}
@@ -278,5 +362,8 @@ void Entry::draw() {
 }
 
 nlohmann::json Entry::toJson() {
-	return endpoint.toJson();
+	nlohmann::json json = endpoint.toJson();
+	json["rate"] = sampling.rate.load();
+	json["history"] = historyCapacity;
+	return json;
 }
@@ -0,0 +1,205 @@
+#include "pch.h"
+#include "SerialTransport.h"
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+#ifdef _WIN32
+
+bool SerialTransport::openPort(uint32_t baudrate) {
+	std::string path = "\\\\.\\" + port;		// Needed for COM10 and above
+	HANDLE h = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, FILE_FLAG_OVERLAPPED, NULL);
+	if (h == INVALID_HANDLE_VALUE)
+		return false;
+
+	DCB dcb = { 0 };
+	dcb.DCBlength = sizeof(dcb);
+	if (!GetCommState(h, &dcb)) {
+		CloseHandle(h);
+		return false;
+	}
+	dcb.BaudRate = baudrate;
+	dcb.ByteSize = 8;
+	dcb.Parity = NOPARITY;
+	dcb.StopBits = ONESTOPBIT;
+	dcb.fBinary = TRUE;
+	dcb.fOutxCtsFlow = FALSE;
+	dcb.fRtsControl = RTS_CONTROL_DISABLE;
+	dcb.fOutX = FALSE;
+	dcb.fInX = FALSE;
+
+	// Return whatever arrived as soon as there is a gap, or after the read timeout if nothing came
+	COMMTIMEOUTS timeouts = { 0 };
+	timeouts.ReadIntervalTimeout = 1;
+	timeouts.ReadTotalTimeoutConstant = (DWORD)(SERIAL_READ_TIMEOUT * 1000);
+	if (!SetCommState(h, &dcb) || !SetCommTimeouts(h, &timeouts)) {
+		CloseHandle(h);
+		return false;
+	}
+
+	// Overlapped, so the IN thread waiting for data does not block the writes of the OUT thread.
+	// Each of them has its own event.
+	HANDLE readEvent = CreateEventA(NULL, TRUE, FALSE, NULL);
+	HANDLE writeEvent = CreateEventA(NULL, TRUE, FALSE, NULL);
+	if (readEvent == NULL || writeEvent == NULL) {
+		if (readEvent) CloseHandle(readEvent);
+		if (writeEvent) CloseHandle(writeEvent);
+		CloseHandle(h);
+		return false;
+	}
+
+	PurgeComm(h, PURGE_RXCLEAR | PURGE_TXCLEAR);
+	handle = (intptr_t)h;
+	this->readEvent = (intptr_t)readEvent;
+	this->writeEvent = (intptr_t)writeEvent;
+	return true;
+}
+
+void SerialTransport::closePort() {
+	CloseHandle((HANDLE)handle);
+	CloseHandle((HANDLE)readEvent);
+	CloseHandle((HANDLE)writeEvent);
+}
+
+// Wait for an overlapped operation that was just started. Returns false on error, 'count' is what was transferred.
+static bool completeOverlapped(HANDLE h, OVERLAPPED* overlapped, BOOL started, DWORD timeout, DWORD* count) {
+	if (!started && GetLastError() != ERROR_IO_PENDING)
+		return false;
+
+	if (WaitForSingleObject(overlapped->hEvent, timeout) != WAIT_OBJECT_0) {
+		CancelIoEx(h, overlapped);
+	}
+	return GetOverlappedResult(h, overlapped, count, TRUE) || GetLastError() == ERROR_OPERATION_ABORTED;
+}
+
+int SerialTransport::readPort(uint8_t* data, size_t length) {
+	OVERLAPPED overlapped = { 0 };
+	overlapped.hEvent = (HANDLE)readEvent;
+	ResetEvent(overlapped.hEvent);
+
+	DWORD count = 0;
+	// The read completes within the comm timeouts, the wait timeout is only a safety net for a stuck driver
+	BOOL started = ReadFile((HANDLE)handle, data, (DWORD)length, NULL, &overlapped);
+	if (!completeOverlapped((HANDLE)handle, &overlapped, started, (DWORD)(SERIAL_READ_TIMEOUT * 1000) * 10, &count))
+		return -1;
+
+	return (int)count;
+}
+
+bool SerialTransport::writePort(const uint8_t* data, size_t length) {
+	OVERLAPPED overlapped = { 0 };
+	overlapped.hEvent = (HANDLE)writeEvent;
+	ResetEvent(overlapped.hEvent);
+
+	DWORD count = 0;
+	BOOL started = WriteFile((HANDLE)handle, data, (DWORD)length, NULL, &overlapped);
+	return completeOverlapped((HANDLE)handle, &overlapped, started, INFINITE, &count) && count == length;
+}
+
+#else
+
+// Only the standard rates have a speed_t constant
+static bool toSpeed(uint32_t baudrate, speed_t* speed) {
+	switch (baudrate) {
+	case 9600:		*speed = B9600; return true;
+	case 19200:		*speed = B19200; return true;
+	case 38400:		*speed = B38400; return true;
+	case 57600:		*speed = B57600; return true;
+	case 115200:	*speed = B115200; return true;
+	case 230400:	*speed = B230400; return true;
+#ifdef B921600
+	case 460800:	*speed = B460800; return true;
+	case 921600:	*speed = B921600; return true;
+#endif
+	default:		return false;
+	}
+}
+
+bool SerialTransport::openPort(uint32_t baudrate) {
+	speed_t speed;
+	if (!toSpeed(baudrate, &speed)) {
+		LOG_ERROR("Serial port {}: Baud rate {} is not supported", port, baudrate);
+		return false;
+	}
+
+	int fd = ::open(port.c_str(), O_RDWR | O_NOCTTY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+
+	struct termios tty;
+	if (tcgetattr(fd, &tty) != 0) {
+		::close(fd);
+		return false;
+	}
+	cfmakeraw(&tty);
+	cfsetispeed(&tty, speed);
+	cfsetospeed(&tty, speed);
+	tty.c_cflag |= CLOCAL | CREAD;
+	tty.c_cflag &= ~CSTOPB;
+	tty.c_cc[VMIN] = 0;		// Return whatever arrived, readPort() waits with poll() first
+	tty.c_cc[VTIME] = 0;
+	if (tcsetattr(fd, TCSANOW, &tty) != 0) {
+		::close(fd);
+		return false;
+	}
+
+	tcflush(fd, TCIOFLUSH);
+	handle = fd;
+	return true;
+}
+
+void SerialTransport::closePort() {
+	::close((int)handle);
+}
+
+int SerialTransport::readPort(uint8_t* data, size_t length) {
+	while (true) {
+		struct pollfd fd = { (int)handle, POLLIN, 0 };
+		int ready = ::poll(&fd, 1, (int)(SERIAL_READ_TIMEOUT * 1000));
+		if (ready < 0 && errno == EINTR)
+			continue;
+		if (ready < 0)
+			return -1;
+		if (ready == 0)
+			return 0;		// Timeout
+
+		if (fd.revents & (POLLERR | POLLNVAL))
+			return -1;
+
+		ssize_t count = ::read((int)handle, data, length);
+		if (count < 0 && errno == EINTR)
+			continue;
+
+		// poll() said there is something to read, so nothing at all means the other end hung up,
+		// e.g. a USB adapter was unplugged or the master side of a pseudo-terminal was closed
+		if (count == 0) {
+			LOG_WARN("Serial port {}: Hangup", port);
+			return -1;
+		}
+		return (int)count;
+	}
+}
+
+bool SerialTransport::writePort(const uint8_t* data, size_t length) {
+	while (length > 0) {
+		ssize_t count = ::write((int)handle, data, length);
+		if (count < 0) {
+			if (errno == EINTR)
+				continue;
+
+			return false;
+		}
+		data += count;
+		length -= count;
+	}
+	return true;
+}
+
+#endif
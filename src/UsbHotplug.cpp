@@ -0,0 +1,58 @@
+#include "pch.h"
+#include "UsbHotplug.h"
+
+#include "libusb.h"
+
+struct UsbHotplugCallback {
+	static int LIBUSB_CALL onEvent(libusb_context* context, libusb_device* device, libusb_hotplug_event event, void* userData) {
+		if (event == LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED) {
+			((UsbHotplug*)userData)->onArrival();
+		}
+		return 0;		// Stay registered
+	}
+};
+
+// Uses its own libusb context, the one of libusbcpp is not accessible
+UsbHotplug::UsbHotplug(uint16_t vendorID, uint16_t productID) {
+
+	if (!libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG)) {
+		LOG_DEBUG("USB hotplug events are not supported on this platform");
+		return;
+	}
+
+	libusb_context* ctx = nullptr;
+	if (libusb_init(&ctx) != LIBUSB_SUCCESS) {
+		LOG_WARN("Failed to initialize libusb for hotplug events");
+		return;
+	}
+
+	int result = libusb_hotplug_register_callback(ctx, LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED, LIBUSB_HOTPLUG_NO_FLAGS,
+		vendorID, productID, LIBUSB_HOTPLUG_MATCH_ANY, &UsbHotplugCallback::onEvent, this, &callbackHandle);
+	if (result != LIBUSB_SUCCESS) {
+		LOG_WARN("Failed to register the USB hotplug callback: {}", libusb_error_name(result));
+		libusb_exit(ctx);
+		return;
+	}
+
+	context = ctx;
+	supported = true;
+	eventThread = std::thread(&UsbHotplug::eventLoop, this);
+}
+
+UsbHotplug::~UsbHotplug() {
+	if (!supported)
+		return;
+
+	stopped = true;
+	libusb_hotplug_deregister_callback((libusb_context*)context, callbackHandle);	// Also interrupts the event handling
+	eventThread.join();
+	libusb_exit((libusb_context*)context);
+}
+
+// The callback is called from in here
+void UsbHotplug::eventLoop() {
+	while (!stopped) {
+		timeval timeout = { 0, 100000 };
+		libusb_handle_events_timeout_completed((libusb_context*)context, &timeout, nullptr);
+	}
+}
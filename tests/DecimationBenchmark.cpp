@@ -0,0 +1,45 @@
+#include "pch.h"
+#include "Decimation.h"
+#include "DecimationReference.h"
+
+// The decimation kernels against their scalar references on 1M samples, the best of several runs each
+
+#define BENCHMARK_SAMPLES 1000000
+#define BENCHMARK_RUNS 20
+
+// Milliseconds of the fastest run
+template<typename F>
+static double measure(F&& run) {
+	double best = 1e9;
+	for (int i = 0; i < BENCHMARK_RUNS; i++) {
+		double start = Runtime::getTime();
+		run();
+		best = std::min(best, Runtime::getTime() - start);
+	}
+	return best * 1000.0;
+}
+
+int main() {
+	std::vector<double> x, y;
+	makeSignal(BENCHMARK_SAMPLES, &x, &y);
+	volatile double sink = 0.0;		// Keeps the results alive
+
+	double min, max;
+	double simd = measure([&] { findMinMax(y.data(), y.size(), &min, &max); sink = sink + min + max; });
+	double scalar = measure([&] { findMinMaxReference(y.data(), y.size(), &min, &max); sink = sink + min + max; });
+	fmt::print("findMinMax        {:7.3f} ms  (scalar {:7.3f} ms)\n", simd, scalar);
+
+	const size_t columns = 1000;
+	std::vector<DecimatedColumn> out(columns);
+	simd = measure([&] { sink = sink + decimateMinMax(x.data(), y.data(), x.size(), x.front(), x.back(), out.data(), columns); });
+	scalar = measure([&] { sink = sink + decimateMinMaxReference(x.data(), y.data(), x.size(), x.front(), x.back(), out.data(), columns); });
+	fmt::print("min/max -> {:5}  {:7.3f} ms  (scalar {:7.3f} ms)\n", columns, simd, scalar);
+
+	const size_t threshold = 2000;
+	std::vector<double> outX(threshold), outY(threshold);
+	simd = measure([&] { sink = sink + decimateLTTB(x.data(), y.data(), x.size(), threshold, outX.data(), outY.data()); });
+	scalar = measure([&] { sink = sink + decimateLTTBReference(x.data(), y.data(), x.size(), threshold, outX.data(), outY.data()); });
+	fmt::print("LTTB -> {:5}     {:7.3f} ms  (scalar {:7.3f} ms)\n", threshold, simd, scalar);
+
+	return 0;
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include "pch.h"
+#include "Decimation.h"
+
+#include <random>
+
+// Straightforward scalar versions of the kernels in Decimation.h, to check them against and to measure what the
+// SIMD paths gain. They compute the same expressions in the same order where the results are compared exactly.
+
+static void findMinMaxReference(const double* values, size_t count, double* min, double* max) {
+	*min = values[0];
+	*max = values[0];
+	for (size_t i = 1; i < count; i++) {
+		*min = std::min(*min, values[i]);
+		*max = std::max(*max, values[i]);
+	}
+}
+
+// One pass over all samples instead of a binary search per column
+static size_t decimateMinMaxReference(const double* x, const double* y, size_t count, double xMin, double xMax,
+									  DecimatedColumn* out, size_t columns) {
+
+	if (columns == 0 || !(xMax > xMin)) {
+		return 0;
+	}
+
+	double width = (xMax - xMin) / columns;
+	for (size_t c = 0; c < columns; c++) {
+		out[c].count = 0;
+	}
+
+	size_t c = 0;
+	size_t inView = 0;
+	for (size_t i = 0; i < count; i++) {
+		if (x[i] < xMin)
+			continue;
+
+		while (c < columns && x[i] >= ((c + 1 == columns) ? xMax : xMin + (c + 1) * width)) {
+			c++;
+		}
+		if (c == columns)
+			break;
+
+		DecimatedColumn& column = out[c];
+		if (column.count == 0) {
+			column.min = column.max = column.first = y[i];
+		}
+		column.min = std::min(column.min, y[i]);
+		column.max = std::max(column.max, y[i]);
+		column.last = y[i];
+		column.count++;
+		inView++;
+	}
+
+	return inView;
+}
+
+static size_t decimateLTTBReference(const double* x, const double* y, size_t count, size_t threshold, double* outX, double* outY) {
+
+	threshold = std::max<size_t>(threshold, 3);
+	if (threshold >= count) {
+		std::copy(x, x + count, outX);
+		std::copy(y, y + count, outY);
+		return count;
+	}
+
+	double every = (double)(count - 2) / (threshold - 2);
+	size_t n = 0;
+	size_t a = 0;
+	outX[n] = x[0];
+	outY[n] = y[0];
+	n++;
+
+	for (size_t bucket = 0; bucket < threshold - 2; bucket++) {
+		size_t from = (size_t)(bucket * every) + 1;
+		size_t to = std::max((size_t)((bucket + 1) * every) + 1, from + 1);
+		size_t nextFrom = (size_t)((bucket + 1) * every) + 1;
+		size_t nextTo = std::min((size_t)((bucket + 2) * every) + 1, count);
+
+		double cx = x[count - 1];
+		double cy = y[count - 1];
+		if (nextTo > nextFrom) {
+			double sumX = 0.0;
+			double sumY = 0.0;
+			for (size_t i = nextFrom; i < nextTo; i++) {
+				sumX += x[i];
+				sumY += y[i];
+			}
+			cx = sumX / (nextTo - nextFrom);
+			cy = sumY / (nextTo - nextFrom);
+		}
+
+		double dx = x[a] - cx;
+		double dy = cy - y[a];
+		double k = dx * y[a] + dy * x[a];
+		double maxArea = -1.0;
+		size_t maxIndex = from;
+		for (size_t i = from; i < to; i++) {
+			double area = std::abs(dx * y[i] + dy * x[i] - k);
+			if (area > maxArea) {
+				maxArea = area;
+				maxIndex = i;
+			}
+		}
+
+		a = maxIndex;
+		outX[n] = x[a];
+		outY[n] = y[a];
+		n++;
+	}
+
+	outX[n] = x[count - 1];
+	outY[n] = y[count - 1];
+	n++;
+	return n;
+}
+
+// A noisy signal with steps, sampled at 1 kHz with some jitter, always the same for the same seed
+static void makeSignal(size_t count, std::vector<double>* x, std::vector<double>* y, uint32_t seed = 1) {
+	std::mt19937 random(seed);
+	std::uniform_real_distribution<double> jitter(0.0, 0.0005);
+	std::normal_distribution<double> noise(0.0, 0.1);
+
+	x->resize(count);
+	y->resize(count);
+	for (size_t i = 0; i < count; i++) {
+		(*x)[i] = i * 0.001 + jitter(random);
+		(*y)[i] = std::sin(i * 0.0007) + ((i / 50000) % 2) * 0.5 + noise(random);
+	}
+}
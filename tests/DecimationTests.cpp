@@ -0,0 +1,95 @@
+#include "pch.h"
+#include "Decimation.h"
+#include "DecimationReference.h"
+
+// Checks the decimation kernels against the scalar references in DecimationReference.h.
+// The exit code is the number of failed checks.
+
+static int failures = 0;
+
+#define CHECK(condition) do { \
+		if (!(condition)) { \
+			failures++; \
+			fmt::print("{}:{}: Check failed: {}\n", __FILE__, __LINE__, #condition); \
+		} \
+	} while (0)
+
+static bool operator==(const DecimatedColumn& a, const DecimatedColumn& b) {
+	if (a.count != b.count)
+		return false;
+	return a.count == 0 || (a.min == b.min && a.max == b.max && a.first == b.first && a.last == b.last);
+}
+
+static void testFindMinMax() {
+	std::vector<double> x, y;
+	makeSignal(1000, &x, &y);
+
+	for (size_t count = 1; count <= 9; count++) {		// Every way the SIMD loop and the tail can split
+		for (size_t offset = 0; offset < 3; offset++) {
+			double min, max, refMin, refMax;
+			findMinMax(y.data() + offset, count, &min, &max);
+			findMinMaxReference(y.data() + offset, count, &refMin, &refMax);
+			CHECK(min == refMin && max == refMax);
+		}
+	}
+
+	double min, max, refMin, refMax;
+	findMinMax(y.data(), y.size(), &min, &max);
+	findMinMaxReference(y.data(), y.size(), &refMin, &refMax);
+	CHECK(min == refMin && max == refMax);
+}
+
+static void testDecimateMinMax() {
+	std::vector<double> x, y;
+	makeSignal(100000, &x, &y);
+
+	struct View { double xMin; double xMax; size_t columns; };
+	for (auto view : { View{ 0.0, 100.0, 1000 }, View{ 12.3, 45.6, 777 }, View{ -5.0, 3.0, 100 },
+					   View{ 99.0, 200.0, 50 }, View{ 50.0, 50.01, 300 }, View{ 1.0, 2.0, 1 } }) {
+		std::vector<DecimatedColumn> columns(view.columns);
+		std::vector<DecimatedColumn> reference(view.columns);
+		size_t count = decimateMinMax(x.data(), y.data(), x.size(), view.xMin, view.xMax, columns.data(), view.columns);
+		size_t refCount = decimateMinMaxReference(x.data(), y.data(), x.size(), view.xMin, view.xMax, reference.data(), view.columns);
+		CHECK(count == refCount);
+		CHECK(columns == reference);
+	}
+
+	DecimatedColumn column;
+	CHECK(decimateMinMax(x.data(), y.data(), x.size(), 10.0, 10.0, &column, 1) == 0);		// Empty view
+	CHECK(decimateMinMax(x.data(), y.data(), x.size(), 0.0, 10.0, &column, 0) == 0);
+}
+
+static void testDecimateLTTB() {
+	std::vector<double> x, y;
+	makeSignal(100000, &x, &y);
+
+	for (size_t threshold : { 0, 1, 2, 3, 4, 5, 100, 2000, 99999, 100000, 200000 }) {
+		std::vector<double> outX(std::max<size_t>(threshold, 3)), outY(outX.size());
+		std::vector<double> refX(outX.size()), refY(outX.size());
+		size_t count = decimateLTTB(x.data(), y.data(), x.size(), threshold, outX.data(), outY.data());
+		size_t refCount = decimateLTTBReference(x.data(), y.data(), x.size(), threshold, refX.data(), refY.data());
+		CHECK(count == std::min<size_t>(std::max<size_t>(threshold, 3), x.size()));
+		CHECK(count == refCount);
+		CHECK(outX == refX && outY == refY);
+		CHECK(outX[0] == x.front() && outX[count - 1] == x.back());
+	}
+
+	// Fewer samples than the threshold are copied
+	double outX[3], outY[3];
+	CHECK(decimateLTTB(x.data(), y.data(), 2, 0, outX, outY) == 2);
+	CHECK(outX[1] == x[1] && outY[1] == y[1]);
+}
+
+int main() {
+	testFindMinMax();
+	testDecimateMinMax();
+	testDecimateLTTB();
+
+	if (failures > 0) {
+		fmt::print("{} checks failed\n", failures);
+	}
+	else {
+		fmt::print("All checks passed\n");
+	}
+	return failures;
+}
@@ -0,0 +1,103 @@
+#include "pch.h"
+#include "ODrive.h"
+#include "SoftwareODrive.h"
+#include "LoopbackTransport.h"
+
+// Throughput of the native protocol stack against a SoftwareODrive over a LoopbackTransport, for a few link
+// latencies and batch sizes. The latency is per frame, pipelined requests overlap like on a real link.
+
+#define BENCHMARK_DURATION 1.0		// Seconds per measurement
+
+static const std::vector<std::string> readIdentifiers = {
+	"vbus_voltage", "ibus",
+	"axis0.motor.current_control.Iq_setpoint", "axis0.motor.current_control.Iq_measured",
+	"axis0.encoder.pos_estimate", "axis0.encoder.vel_estimate",
+	"axis0.controller.input_pos", "axis0.controller.input_vel"
+};
+
+static const std::vector<std::string> writeIdentifiers = {
+	"axis0.controller.input_pos", "axis0.controller.input_vel",
+	"axis1.controller.input_pos", "axis0.motor.config.current_lim"
+};
+
+// Endpoints read in one batch, the identifiers are repeated until the batch is full
+static std::vector<std::pair<uint16_t, EndpointValueType>> makeReadBatch(ODrive& odrive, size_t batchSize) {
+	std::vector<std::pair<uint16_t, EndpointValueType>> batch;
+	for (size_t i = 0; i < batchSize; i++) {
+		auto endpoint = odrive.findEndpoint(readIdentifiers[i % readIdentifiers.size()]);
+		batch.emplace_back(endpoint.id, endpoint.type);
+	}
+	return batch;
+}
+
+static void benchmarkReads(double latency, size_t batchSize) {
+	auto model = std::make_shared<SoftwareODrive>(SoftwareODrive::defaultDescriptor(), 0x1000);
+	ODrive odrive(std::make_unique<LoopbackTransport>(model, latency));
+	if (!odrive.loaded) {
+		fmt::print("Failed to connect to the simulated ODrive\n");
+		return;
+	}
+
+	auto batch = makeReadBatch(odrive, batchSize);
+	size_t reads = 0;
+	size_t failed = 0;
+	double start = Runtime::getTime();
+	while (Runtime::getTime() - start < BENCHMARK_DURATION) {
+		for (auto& value : odrive.readMany(batch)) {
+			if (value.type() == EndpointValueType::INVALID) {
+				failed++;
+			}
+		}
+		reads += batch.size();
+	}
+	double elapsed = Runtime::getTime() - start;
+
+	fmt::print("  reads   latency {:6.2f} ms  batch {:3}  {:10.0f} endpoints/s  {:8.0f} batches/s  {} failed\n",
+		latency * 1000.0, batchSize, reads / elapsed, reads / batchSize / elapsed, failed);
+}
+
+static void benchmarkWrites(double latency, size_t batchSize, WriteMode mode) {
+	auto model = std::make_shared<SoftwareODrive>(SoftwareODrive::defaultDescriptor(), 0x2000);
+	ODrive odrive(std::make_unique<LoopbackTransport>(model, latency));
+	if (!odrive.loaded) {
+		fmt::print("Failed to connect to the simulated ODrive\n");
+		return;
+	}
+
+	std::vector<uint16_t> endpoints;
+	for (auto& identifier : writeIdentifiers) {
+		endpoints.push_back(odrive.findEndpoint(identifier).id);
+	}
+
+	// Writes to the same endpoint replace each other in the queue, so a batch holds at most one per endpoint
+	batchSize = std::min(batchSize, endpoints.size());
+	size_t writes = 0;
+	float value = 0.f;
+	double start = Runtime::getTime();
+	while (Runtime::getTime() - start < BENCHMARK_DURATION) {
+		for (size_t i = 0; i < batchSize; i++) {
+			odrive.queueWrite(endpoints[i], value, mode);
+		}
+		writes += odrive.flushWrites();
+		value += 1.f;
+	}
+	double elapsed = Runtime::getTime() - start;
+
+	fmt::print("  writes  latency {:6.2f} ms  batch {:3}  {:10.0f} endpoints/s  {:8.0f} batches/s  {}\n",
+		latency * 1000.0, batchSize, writes / elapsed, writes / batchSize / elapsed,
+		mode == WriteMode::ACKNOWLEDGED ? "acknowledged" : "unacknowledged");
+}
+
+int main() {
+	fmt::print("Loopback protocol throughput\n");
+	for (double latency : { 0.0, 0.0005, 0.002 }) {
+		for (size_t batchSize : { 1, 8, 32 }) {
+			benchmarkReads(latency, batchSize);
+		}
+		for (size_t batchSize : { 1, 4 }) {
+			benchmarkWrites(latency, batchSize, WriteMode::ACKNOWLEDGED);
+			benchmarkWrites(latency, batchSize, WriteMode::UNACKNOWLEDGED);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,472 @@
+#include "pch.h"
+#include "ODrive.h"
+#include "SoftwareODrive.h"
+#include "LoopbackTransport.h"
+#include "SerialTransport.h"
+
+#include <filesystem>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <unistd.h>
+#endif
+
+// Runs the native protocol stack of ODrive against a SoftwareODrive over a LoopbackTransport, no hardware needed.
+// The exit code is the number of failed checks.
+
+#define TEST_LATENCY 0.0005		// Per frame, in seconds, so pipelined requests overlap
+
+static int failures = 0;
+
+#define CHECK(condition) do { \
+		if (!(condition)) { \
+			failures++; \
+			fmt::print("{}:{}: Check failed: {}\n", __FILE__, __LINE__, #condition); \
+		} \
+	} while (0)
+
+// Passes everything through and records the sequence numbers of the responses in the order they arrive
+class RecordingTransport : public Transport {
+public:
+
+	RecordingTransport(std::unique_ptr<Transport> transport) : transport(std::move(transport)) {}
+
+	void start(ReceiveCallback onReceive, ErrorCallback onError) override {
+		transport->start([this, onReceive](const uint8_t* data, size_t length) {
+			if (length >= 2) {
+				std::lock_guard<std::mutex> lock(mutex);
+				responses.push_back((data[0] | data[1] << 8) & ODRIVE_SEQUENCE_MASK);
+			}
+			onReceive(data, length);
+		}, onError);
+	}
+
+	bool sendFrame(const uint8_t* data, size_t length) override { return transport->sendFrame(data, length); }
+	void stop() override { transport->stop(); }
+	void close() override { transport->close(); }
+	TransportStats getStats() override { return transport->getStats(); }
+
+	std::vector<uint16_t> getResponses() {
+		std::lock_guard<std::mutex> lock(mutex);
+		return responses;
+	}
+
+private:
+	std::unique_ptr<Transport> transport;
+	std::vector<uint16_t> responses;
+	std::mutex mutex;
+};
+
+// One write as the device received it
+struct RecordedWrite {
+	uint16_t endpoint;
+	bool acknowledged;
+
+	bool operator==(const RecordedWrite& other) const {
+		return endpoint == other.endpoint && acknowledged == other.acknowledged;
+	}
+};
+
+// Records every write the device receives, in order
+class RecordingModel : public DeviceModel {
+public:
+
+	RecordingModel(std::shared_ptr<DeviceModel> model) : model(model) {}
+
+	int handleFrame(const uint8_t* frame, size_t length, uint8_t* response, size_t maxResponseLength) override {
+		uint16_t endpoint = frame[2] | frame[3] << 8;
+		if (length > 8 && (endpoint & 0x7FFF) != 0) {		// A payload on anything but the JSON endpoint is a write
+			std::lock_guard<std::mutex> lock(mutex);
+			writes.push_back({ (uint16_t)(endpoint & 0x7FFF), (endpoint & 0x8000) != 0 });
+		}
+		return model->handleFrame(frame, length, response, maxResponseLength);
+	}
+
+	std::vector<RecordedWrite> takeWrites() {
+		std::lock_guard<std::mutex> lock(mutex);
+		std::vector<RecordedWrite> taken;
+		taken.swap(writes);
+		return taken;
+	}
+
+private:
+	std::shared_ptr<DeviceModel> model;
+	std::vector<RecordedWrite> writes;
+	std::mutex mutex;
+};
+
+// The default descriptor with one extra endpoint, so every variant has its own JSON CRC
+static std::string makeVariant(int variant) {
+	auto json = nlohmann::json::parse(SoftwareODrive::defaultDescriptor());
+	json.push_back({ { "name", "variant" + std::to_string(variant) }, { "id", 900 + variant }, { "type", "float" }, { "access", "r" } });
+	return json.dump();
+}
+
+// A read or write request frame as the ODrive sends it
+static std::vector<uint8_t> makeFrame(uint16_t sequence, uint16_t endpoint, uint16_t responseSize, std::vector<uint8_t> payload, uint16_t trailer) {
+	std::vector<uint8_t> frame = {
+		(uint8_t)sequence, (uint8_t)(sequence >> 8),
+		(uint8_t)endpoint, (uint8_t)((endpoint | 0x8000) >> 8),
+		(uint8_t)responseSize, (uint8_t)(responseSize >> 8)
+	};
+	frame.insert(frame.end(), payload.begin(), payload.end());
+	frame.push_back((uint8_t)trailer);
+	frame.push_back((uint8_t)(trailer >> 8));
+	return frame;
+}
+
+static void testConnect() {
+	auto model = std::make_shared<SoftwareODrive>(SoftwareODrive::defaultDescriptor(), 0x3456789A);
+	ODrive odrive(std::make_unique<LoopbackTransport>(model, TEST_LATENCY));
+
+	CHECK(odrive.loaded);
+	CHECK(odrive.getSerialNumber() == 0x3456789A);
+	CHECK(odrive.jsonCRC == CRC16_JSON((uint8_t*)SoftwareODrive::defaultDescriptor().data(), SoftwareODrive::defaultDescriptor().length()));
+
+	float voltage = 0.f;
+	CHECK(odrive.readVbusVoltage(&voltage));
+	CHECK(voltage == 24.f);
+}
+
+// Every value must still end up at the request it belongs to
+static void testReorderedAndDuplicateResponses() {
+	const std::vector<std::string> identifiers = {
+		"vbus_voltage", "ibus",
+		"axis0.motor.current_control.Iq_setpoint", "axis0.motor.current_control.Iq_measured",
+		"axis0.encoder.pos_estimate", "axis0.encoder.vel_estimate", "axis0.controller.input_pos",
+		"axis1.motor.current_control.Iq_setpoint", "axis1.motor.current_control.Iq_measured",
+		"axis1.encoder.pos_estimate", "axis1.encoder.vel_estimate", "axis1.controller.input_pos"
+	};
+
+	auto model = std::make_shared<SoftwareODrive>(SoftwareODrive::defaultDescriptor(), 0x1000);
+	for (size_t i = 0; i < identifiers.size(); i++) {
+		model->setValue<float>(identifiers[i], 1.25f * (i + 1));
+	}
+
+	LoopbackFaults faults;
+	faults.reorderEvery = 3;
+	faults.duplicateEvery = 5;
+	auto transport = std::make_unique<RecordingTransport>(std::make_unique<LoopbackTransport>(model, TEST_LATENCY, faults));
+	RecordingTransport* recorder = transport.get();
+	ODrive odrive(std::move(transport));
+	CHECK(odrive.loaded);		// The JSON definition was downloaded under the same faults
+	CHECK(odrive.getSerialNumber() == 0x1000);
+
+	std::vector<std::pair<uint16_t, EndpointValueType>> requests;
+	for (int round = 0; round < 4; round++) {
+		for (auto& identifier : identifiers) {
+			requests.emplace_back(odrive.findEndpoint(identifier).id, EndpointValueType::FLOAT);
+		}
+	}
+
+	auto values = odrive.readMany(requests);
+	CHECK(values.size() == requests.size());
+	for (size_t i = 0; i < values.size(); i++) {
+		CHECK(values[i].type() == EndpointValueType::FLOAT);
+		CHECK(values[i].get<float>() == 1.25f * (i % identifiers.size() + 1));
+	}
+
+	// Make sure the faults actually happened
+	auto responses = recorder->getResponses();
+	size_t reordered = 0;
+	size_t duplicated = 0;
+	for (size_t i = 1; i < responses.size(); i++) {
+		reordered += (responses[i] < responses[i - 1]);
+		duplicated += (responses[i] == responses[i - 1]);
+	}
+	CHECK(reordered > 0);
+	CHECK(duplicated > 0);
+
+	auto stats = odrive.getResponseStats();
+	CHECK(stats.duplicate > 0);
+	CHECK(stats.unmatched == 0);
+}
+
+static void testWrongCrcDropped() {
+
+	// The device answers nothing that was built for a different JSON definition
+	std::string json = SoftwareODrive::defaultDescriptor();
+	uint16_t jsonCRC = CRC16_JSON((uint8_t*)json.data(), json.length());
+	SoftwareODrive model(json, 0x2000);
+	uint8_t response[ODRIVE_MAX_FRAME_SIZE];
+
+	auto frame = makeFrame(1, 1, sizeof(float), {}, jsonCRC);		// vbus_voltage
+	CHECK(model.handleFrame(frame.data(), frame.size(), response, sizeof(response)) == 2 + sizeof(float));
+	frame = makeFrame(2, 1, sizeof(float), {}, jsonCRC + 1);
+	CHECK(model.handleFrame(frame.data(), frame.size(), response, sizeof(response)) == -1);
+	frame = makeFrame(3, 0, ODRIVE_JSON_CHUNK_SIZE, { 0, 0, 0, 0 }, jsonCRC);	// The JSON itself is always read with CRC 1
+	CHECK(model.handleFrame(frame.data(), frame.size(), response, sizeof(response)) == -1);
+	frame = makeFrame(4, 0, ODRIVE_JSON_CHUNK_SIZE, { 0, 0, 0, 0 }, 1);
+	CHECK(model.handleFrame(frame.data(), frame.size(), response, sizeof(response)) == 2 + ODRIVE_JSON_CHUNK_SIZE);
+
+	// The cached descriptors of other devices are probed with their CRC, the device drops those probes.
+	// They must not keep their slots in the in-flight window or stall the connection.
+	auto directory = std::filesystem::temp_directory_path() / "ODriveGuiProtocolTests";
+	std::filesystem::remove_all(directory);
+	DescriptorCache cache(directory.string() + "/");
+	for (int variant = 0; variant < 4; variant++) {
+		auto known = std::make_shared<SoftwareODrive>(makeVariant(variant), 0x2100 + variant);
+		ODrive odrive(std::make_unique<LoopbackTransport>(known, TEST_LATENCY), &cache);
+		CHECK(odrive.loaded);
+	}
+
+	for (int variant : { 2, 7 }) {		// One that is cached and one that is not
+		auto device = std::make_shared<SoftwareODrive>(makeVariant(variant), 0x2200 + variant);
+		double start = Runtime::getTime();
+		ODrive odrive(std::make_unique<LoopbackTransport>(device, TEST_LATENCY), &cache);
+		CHECK(Runtime::getTime() - start < ODRIVE_TIMEOUT);		// Not waiting for the dropped probes one by one
+		CHECK(odrive.loaded);
+		CHECK(odrive.getSerialNumber() == 0x2200 + variant);
+
+		// More reads than the in-flight window holds, they only all succeed if no slot leaked
+		auto voltage = odrive.findEndpoint("vbus_voltage");
+		std::vector<std::pair<uint16_t, EndpointValueType>> requests(4 * ODRIVE_DEFAULT_MAX_IN_FLIGHT, { voltage.id, EndpointValueType::FLOAT });
+		start = Runtime::getTime();
+		auto values = odrive.readMany(requests);
+		CHECK(Runtime::getTime() - start < ODRIVE_TIMEOUT);
+		for (auto& value : values) {
+			CHECK(value.type() == EndpointValueType::FLOAT && value.get<float>() == 24.f);
+		}
+	}
+
+	std::filesystem::remove_all(directory);
+}
+
+// Queued writes reach the device in the order they were first written, whatever their write mode
+static void testWriteOrder() {
+	auto model = std::make_shared<RecordingModel>(std::make_shared<SoftwareODrive>(SoftwareODrive::defaultDescriptor(), 0x4000));
+	ODrive odrive(std::make_unique<LoopbackTransport>(model, TEST_LATENCY));
+	CHECK(odrive.loaded);
+	model->takeWrites();
+
+	uint16_t controlMode = odrive.findEndpoint("axis0.controller.config.control_mode").id;
+	uint16_t inputPos = odrive.findEndpoint("axis0.controller.input_pos").id;
+	uint16_t requestedState = odrive.findEndpoint("axis0.requested_state").id;
+	uint16_t inputVel = odrive.findEndpoint("axis0.controller.input_vel").id;
+	uint16_t currentLimit = odrive.findEndpoint("axis0.motor.config.current_lim").id;
+
+	odrive.queueWrite(controlMode, (uint8_t)3, WriteMode::ACKNOWLEDGED);
+	odrive.queueWrite(inputPos, 1.5f, WriteMode::UNACKNOWLEDGED);
+	odrive.queueWrite(requestedState, (uint8_t)8, WriteMode::ACKNOWLEDGED);
+	odrive.queueWrite(inputVel, 2.5f, WriteMode::UNACKNOWLEDGED);
+	odrive.queueWrite(currentLimit, 10.f, WriteMode::ACKNOWLEDGED);
+	CHECK(odrive.flushWrites() == 5);
+	CHECK(model->takeWrites() == std::vector<RecordedWrite>({
+		{ controlMode, true }, { inputPos, false }, { requestedState, true }, { inputVel, false }, { currentLimit, true } }));
+
+	float value = 0.f;
+	CHECK(odrive.read<float>(inputVel, &value) && value == 2.5f);		// Unacknowledged, but it arrived
+	CHECK(odrive.read<float>(currentLimit, &value) && value == 10.f);
+
+	// A newer value replaces the queued one and keeps its place
+	odrive.queueWrite(inputPos, 3.f, WriteMode::UNACKNOWLEDGED);
+	odrive.queueWrite(controlMode, (uint8_t)2, WriteMode::ACKNOWLEDGED);
+	odrive.queueWrite(inputPos, 4.f, WriteMode::UNACKNOWLEDGED);
+	CHECK(odrive.flushWrites() == 2);
+	CHECK(model->takeWrites() == std::vector<RecordedWrite>({ { inputPos, false }, { controlMode, true } }));
+	CHECK(odrive.read<float>(inputPos, &value) && value == 4.f);
+}
+
+// Entries read and write through handles bound once, a handle of another JSON definition is never sent
+static void testHandles() {
+	auto model = std::make_shared<SoftwareODrive>(SoftwareODrive::defaultDescriptor(), 0x4800);
+	ODrive odrive(std::make_unique<LoopbackTransport>(model, TEST_LATENCY));
+	CHECK(odrive.loaded);
+
+	BasicEndpoint voltage;
+	voltage.handle.set(odrive.resolve("vbus_voltage"));
+	BasicEndpoint inputPos = voltage;		// Copies carry the handle
+	inputPos.handle.set(odrive.resolve("axis0.controller.input_pos"));
+	EndpointHandle handle = voltage.handle.get();
+	CHECK(handle && handle.id == odrive.resolve("vbus_voltage").id && handle.jsonCRC == odrive.jsonCRC);
+	CHECK(handle.type == EndpointValueType::FLOAT);
+
+	EndpointHandle stale = inputPos.handle.get();
+	stale.jsonCRC++;
+	CHECK(!odrive.queueWrite(stale, 7.f, WriteMode::ACKNOWLEDGED));
+	CHECK(odrive.queueWrite(inputPos.handle.get(), 2.f, WriteMode::ACKNOWLEDGED));
+	CHECK(odrive.flushWrites() == 1);
+
+	auto values = odrive.readManyAsync(std::vector<EndpointHandle>{ voltage.handle.get(), stale, inputPos.handle.get(), EndpointHandle() }).get();
+	CHECK(values.size() == 4);
+	CHECK(values[0].type() == EndpointValueType::FLOAT && values[0].get<float>() == 24.f);
+	CHECK(values[1].type() == EndpointValueType::INVALID);
+	CHECK(values[2].type() == EndpointValueType::FLOAT && values[2].get<float>() == 2.f);
+	CHECK(values[3].type() == EndpointValueType::INVALID);
+}
+
+// Encodes every payload and collects what the framer delivers from the given bytes
+static std::vector<std::vector<uint8_t>> deframe(StreamFramer& framer, const std::vector<uint8_t>& bytes, size_t chunkSize) {
+	std::vector<std::vector<uint8_t>> packets;
+	for (size_t i = 0; i < bytes.size(); i += chunkSize) {
+		framer.feed(bytes.data() + i, std::min(chunkSize, bytes.size() - i), [&](const uint8_t* packet, size_t length) {
+			packets.emplace_back(packet, packet + length);
+		});
+	}
+	return packets;
+}
+
+static std::vector<uint8_t> makePacket(const std::vector<uint8_t>& payload) {
+	std::vector<uint8_t> packet(STREAM_MAX_PACKET_SIZE);
+	packet.resize(StreamFramer::encode(payload.data(), payload.size(), packet.data()));
+	return packet;
+}
+
+static void testStreamFramer() {
+	std::vector<std::vector<uint8_t>> payloads;
+	for (size_t length : { 0, 1, 8, 64, STREAM_MAX_PAYLOAD_SIZE }) {
+		std::vector<uint8_t> payload(length);
+		for (size_t i = 0; i < length; i++) {
+			payload[i] = (uint8_t)(i * 7 + length);		// Contains the sync byte as well
+		}
+		payloads.push_back(payload);
+	}
+
+	// Round trip, the bytes arriving all at once or one by one
+	std::vector<uint8_t> stream;
+	for (auto& payload : payloads) {
+		auto packet = makePacket(payload);
+		CHECK(packet.size() == STREAM_HEADER_SIZE + payload.size() + STREAM_TRAILER_SIZE);
+		stream.insert(stream.end(), packet.begin(), packet.end());
+	}
+	for (size_t chunkSize : { stream.size(), (size_t)1, (size_t)5 }) {
+		StreamFramer framer;
+		CHECK(deframe(framer, stream, chunkSize) == payloads);
+		CHECK(framer.getErrorCount() == 0);
+	}
+
+	// The payload limit
+	std::vector<uint8_t> tooLong(STREAM_MAX_PAYLOAD_SIZE + 1);
+	uint8_t out[STREAM_MAX_PACKET_SIZE + 1];
+	CHECK(StreamFramer::encode(tooLong.data(), tooLong.size(), out) == 0);
+	{
+		std::vector<uint8_t> header = { STREAM_SYNC_BYTE, STREAM_MAX_PAYLOAD_SIZE + 1, 0 };		// A valid CRC8, but too long
+		header[2] = CRC8(header.data(), 2);
+		header.resize(STREAM_MAX_PACKET_SIZE + 1);
+		auto packet = makePacket(payloads[2]);
+		header.insert(header.end(), packet.begin(), packet.end());
+		StreamFramer framer;
+		CHECK(deframe(framer, header, header.size()) == std::vector<std::vector<uint8_t>>({ payloads[2] }));
+		CHECK(framer.getErrorCount() == 1);
+	}
+
+	// A bad CRC8 or CRC16 drops only that packet
+	for (size_t corrupted : std::vector<size_t>{ 2, STREAM_HEADER_SIZE + 3, STREAM_HEADER_SIZE + payloads[2].size() + 1 }) {
+		auto bad = makePacket(payloads[2]);
+		bad[corrupted] ^= 0x10;
+		auto good = makePacket(payloads[3]);
+		bad.insert(bad.end(), good.begin(), good.end());
+		StreamFramer framer;
+		CHECK(deframe(framer, bad, bad.size()) == std::vector<std::vector<uint8_t>>({ payloads[3] }));
+		CHECK(framer.getErrorCount() > 0);
+	}
+
+	// Garbage, including stray sync bytes and a cut off packet, before good ones. The packets that arrive
+	// while the framer still waits for the rest of the cut off one are found again once its CRC16 fails.
+	{
+		std::vector<uint8_t> bytes = { 0x00, 0x13, STREAM_SYNC_BYTE, 0x55, STREAM_SYNC_BYTE, STREAM_SYNC_BYTE, 0xFF };
+		auto cut = makePacket(payloads[3]);
+		bytes.insert(bytes.end(), cut.begin(), cut.begin() + 20);
+		auto good = makePacket(payloads[2]);
+		std::vector<std::vector<uint8_t>> expected;
+		while (expected.size() * good.size() < cut.size()) {
+			bytes.insert(bytes.end(), good.begin(), good.end());
+			expected.push_back(payloads[2]);
+		}
+		for (size_t chunkSize : { bytes.size(), (size_t)1 }) {
+			StreamFramer framer;
+			CHECK(deframe(framer, bytes, chunkSize) == expected);
+			CHECK(framer.getErrorCount() > 0);
+		}
+	}
+}
+
+#ifndef _WIN32
+
+// The SerialTransport on the slave side of a pseudo-terminal, a SoftwareODrive answers on the master side
+static void testSerialTransportOverPty() {
+	int master = posix_openpt(O_RDWR | O_NOCTTY);
+	CHECK(master >= 0);
+	if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) {
+		return;
+	}
+	std::string slave = ptsname(master);
+
+	auto model = std::make_shared<SoftwareODrive>(SoftwareODrive::defaultDescriptor(), 0x5000);
+	std::atomic<bool> stopped = false;
+	std::thread device([&] {
+		StreamFramer framer;
+		uint8_t data[256];
+		uint8_t response[ODRIVE_MAX_FRAME_SIZE];
+		uint8_t packet[STREAM_MAX_PACKET_SIZE];
+		while (!stopped) {
+			struct pollfd fd = { master, POLLIN, 0 };
+			if (poll(&fd, 1, 10) <= 0 || !(fd.revents & POLLIN))
+				continue;
+
+			ssize_t count = read(master, data, sizeof(data));
+			if (count <= 0)
+				continue;
+
+			framer.feed(data, count, [&](const uint8_t* frame, size_t length) {
+				int responseLength = model->handleFrame(frame, length, response, sizeof(response));
+				if (responseLength >= 0) {
+					size_t packetLength = StreamFramer::encode(response, responseLength, packet);
+					CHECK(write(master, packet, packetLength) == (ssize_t)packetLength);
+				}
+			});
+		}
+	});
+
+	{
+		ODrive odrive(std::make_unique<SerialTransport>(slave));
+		CHECK(odrive.loaded);
+		CHECK(odrive.getSerialNumber() == 0x5000);
+
+		float voltage = 0.f;
+		CHECK(odrive.readVbusVoltage(&voltage));
+		CHECK(voltage == 24.f);
+
+		auto inputPos = odrive.findEndpoint("axis0.controller.input_pos");
+		std::vector<std::pair<uint16_t, EndpointValueType>> requests(4 * ODRIVE_DEFAULT_MAX_IN_FLIGHT, { inputPos.id, EndpointValueType::FLOAT });
+		odrive.queueWrite(inputPos.id, 1.5f, WriteMode::ACKNOWLEDGED);
+		CHECK(odrive.flushWrites() == 1);
+		for (auto& value : odrive.readMany(requests)) {
+			CHECK(value.type() == EndpointValueType::FLOAT && value.get<float>() == 1.5f);
+		}
+
+		// Closing the master side is a hangup, the transport must fail instead of reading nothing forever
+		stopped = true;
+		device.join();
+		close(master);
+		double start = Runtime::getTime();
+		while (odrive.isAvailable() && Runtime::getTime() - start < 1.0) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+		CHECK(!odrive.isAvailable());
+	}
+}
+
+#endif
+
+int main() {
+	testConnect();
+	testReorderedAndDuplicateResponses();
+	testWrongCrcDropped();
+	testWriteOrder();
+	testHandles();
+	testStreamFramer();
+#ifndef _WIN32
+	testSerialTransportOverPty();
+#endif
+
+	if (failures > 0) {
+		fmt::print("{} checks failed\n", failures);
+	}
+	else {
+		fmt::print("All checks passed\n");
+	}
+	return failures;
+}
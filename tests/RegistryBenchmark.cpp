@@ -0,0 +1,97 @@
+#include "pch.h"
+#include "DeviceRegistry.h"
+#include "SoftwareODrive.h"
+#include "LoopbackTransport.h"
+
+// Cost of the device registry as the number of devices grows: a lookup through the snapshot, with and without
+// a writer publishing new snapshots meanwhile, and one poll cycle over all devices like Backend does it.
+
+#define LOOKUPS_PER_THREAD 2000000
+#define POLL_LATENCY 0.002			// Per frame, in seconds
+#define POLL_READS 16				// Per device and cycle
+#define POLL_CYCLES 50
+
+static std::shared_ptr<ODrive> connect(uint64_t serialNumber, double latency) {
+	auto model = std::make_shared<SoftwareODrive>(SoftwareODrive::defaultDescriptor(), serialNumber);
+	auto odrive = std::make_shared<ODrive>(std::make_unique<LoopbackTransport>(model, latency));
+	odrive->getSerialNumber();
+	return odrive;
+}
+
+// Nanoseconds per get(), every thread looking up all devices in turn
+static double measureLookups(DeviceRegistry& registry, int threads, bool writing) {
+	std::atomic<bool> done = false;
+	std::thread writer;
+	if (writing) {		// Reconnects the first device over and over, which publishes a new snapshot each time
+		writer = std::thread([&, device = registry.get(0)] {
+			while (!done) {
+				registry.add(device);
+				std::this_thread::sleep_for(std::chrono::microseconds(100));
+			}
+		});
+	}
+
+	std::vector<std::thread> readers;
+	std::atomic<size_t> found = 0;
+	double start = Runtime::getTime();
+	for (int t = 0; t < threads; t++) {
+		readers.emplace_back([&] {
+			size_t count = 0;
+			int size = (int)registry.size();
+			for (int i = 0; i < LOOKUPS_PER_THREAD; i++) {
+				count += (registry.get(i % size) != nullptr);
+			}
+			found += count;
+		});
+	}
+	for (auto& reader : readers) {
+		reader.join();
+	}
+	double elapsed = Runtime::getTime() - start;
+
+	done = true;
+	if (writer.joinable()) {
+		writer.join();
+	}
+	return elapsed * 1e9 / LOOKUPS_PER_THREAD;
+}
+
+// Milliseconds per cycle: The reads of all devices are started first and collected afterwards
+static double measurePollCycle(DeviceRegistry& registry) {
+	auto devices = registry.getAll();
+	std::vector<std::vector<std::pair<uint16_t, EndpointValueType>>> requests;
+	for (auto& odrive : *devices) {
+		auto voltage = odrive->findEndpoint("vbus_voltage");
+		requests.emplace_back(POLL_READS, std::make_pair(voltage.id, voltage.type));
+	}
+
+	double start = Runtime::getTime();
+	for (int cycle = 0; cycle < POLL_CYCLES; cycle++) {
+		auto snapshot = registry.getAll();
+		std::vector<std::future<std::vector<EndpointValue>>> results;
+		for (size_t i = 0; i < snapshot->size(); i++) {
+			results.push_back((*snapshot)[i]->readManyAsync(requests[i]));
+		}
+		for (auto& result : results) {
+			result.get();
+		}
+	}
+	return (Runtime::getTime() - start) * 1000.0 / POLL_CYCLES;
+}
+
+int main() {
+	fmt::print("Device registry, {} reads per device and cycle at {} ms latency\n", POLL_READS, POLL_LATENCY * 1000.0);
+	for (size_t count : { 1, 4, 24, 64 }) {
+		DeviceRegistry lookupRegistry;
+		DeviceRegistry pollRegistry;
+		for (size_t i = 0; i < count; i++) {
+			lookupRegistry.add(connect(0x1000 + i, 0.0));
+			pollRegistry.add(connect(0x2000 + i, POLL_LATENCY));
+		}
+
+		fmt::print("  {:2} devices  get() {:5.1f} ns  4 threads {:5.1f} ns  4 threads + writer {:5.1f} ns  poll cycle {:6.2f} ms\n",
+			count, measureLookups(lookupRegistry, 1, false), measureLookups(lookupRegistry, 4, false),
+			measureLookups(lookupRegistry, 4, true), measurePollCycle(pollRegistry));
+	}
+	return 0;
+}
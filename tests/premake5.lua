@@ -0,0 +1,83 @@
+-- Protocol tests and benchmarks. They run the ODrive protocol stack against a simulated device without any hardware,
+-- and build without BatteryEngine and libusbcpp, so they work on any platform:
+--   premake5 --file=tests/premake5.lua gmake2 --json=/usr/include/nlohmann
+--   make -C tests/build config=release
+
+-- nlohmann json, the directory that contains json.hpp
+newoption { trigger = "json", value = "path", description = "Directory of nlohmann/json.hpp (default /usr/include/nlohmann)" }
+local jsonDir = _OPTIONS["json"] or "/usr/include/nlohmann"
+
+
+
+workspace "ODriveProtocolTests"
+    configurations { "Debug", "Release" }
+    location "build"
+    startproject "ProtocolTests"
+
+
+
+-- Everything both projects share
+local function protocolProject()
+    language "C++"
+    cppdialect "C++17"
+    kind "ConsoleApp"
+    location "build"
+    targetdir "bin/%{cfg.buildcfg}"
+    targetname "%{prj.name}"
+
+    defines { "ODRIVE_NO_BATTERY" }     -- Clock and logging come from Runtime.h instead of the engine
+
+    filter "configurations:Debug"
+        defines { "DEBUG", "_DEBUG" }
+        runtime "Debug"
+        symbols "On"
+
+    filter "configurations:Release"
+        defines { "NDEBUG" }
+        runtime "Release"
+        optimize "On"
+
+    filter "system:not windows"
+        links { "fmt", "pthread" }
+
+    filter {}
+
+    includedirs { "../include", jsonDir, path.getdirectory(jsonDir) }
+    files { "../src/CRC.cpp", "../src/DescriptorCache.cpp", "../src/SerialTransport.cpp" }
+end
+
+
+
+project "ProtocolTests"
+    protocolProject()
+    files { "ProtocolTests.cpp" }
+
+    postbuildcommands { "%{cfg.buildtarget.abspath}" }     -- A failed check fails the build
+
+
+
+project "ProtocolBenchmark"
+    protocolProject()
+    files { "ProtocolBenchmark.cpp" }
+
+
+
+-- The plot decimation kernels against their scalar references
+project "DecimationTests"
+    protocolProject()
+    files { "DecimationTests.cpp", "DecimationReference.h", "../src/Decimation.cpp" }
+
+    postbuildcommands { "%{cfg.buildtarget.abspath}" }
+
+
+
+project "DecimationBenchmark"
+    protocolProject()
+    files { "DecimationBenchmark.cpp", "DecimationReference.h", "../src/Decimation.cpp" }
+
+
+
+-- Snapshot lookups and poll cycles of the device registry for growing device counts
+project "RegistryBenchmark"
+    protocolProject()
+    files { "RegistryBenchmark.cpp" }